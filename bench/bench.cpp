@@ -0,0 +1,705 @@
+// Times every stage of rendering the formulas of a corpus and prints
+// percentiles and allocations per stage, as a table on stderr and as JSON.
+//
+// acrylic-bench [--iterations n] [--json path] [corpus files...]
+// acrylic-bench --stress [--mb n]
+// acrylic-bench --kernels [corpus files...]
+// acrylic-bench --incremental [corpus files...]
+#include "lexer.h"
+#include "parser.h"
+#include "layout.h"
+#include "draw.h"
+#include "encode.h"
+#include "kernels.h"
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <sys/resource.h>
+
+#ifndef ACRYLIC_VERSION
+#define ACRYLIC_VERSION "unknown"
+#endif
+
+namespace fs = std::filesystem;
+
+static std::atomic<size_t> g_allocs{ 0 }, g_alloc_bytes{ 0 };
+
+void *operator new(size_t n)
+{
+    ++g_allocs;
+    g_alloc_bytes += n;
+
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+namespace
+{
+    enum Stage
+    {
+        LEX,
+        PARSE,
+        LAYOUT,
+        RASTER,
+        ENCODE,
+        STAGES
+    };
+
+    const char *g_stage_names[STAGES] = { "lex", "parse", "layout", "raster", "encode" };
+
+    struct Samples
+    {
+        // Microseconds of every timed run
+        std::vector<double> us;
+        size_t allocs{ 0 }, bytes{ 0 };
+
+        double percentile(double q) const
+        {
+            if (us.empty())
+                return 0;
+
+            return us[std::min(us.size() - 1, (size_t)(q * (us.size() - 1) + .5))];
+        }
+
+        double mean() const
+        {
+            double sum = 0;
+            for (double t : us)
+                sum += t;
+
+            return us.empty() ? 0 : sum / us.size();
+        }
+    };
+
+    struct Category
+    {
+        std::string name;
+        size_t formulas{ 0 }, failed{ 0 };
+        Samples stages[STAGES];
+    };
+
+    template <typename F>
+    void measure(Samples &s, bool keep, F f)
+    {
+        size_t allocs = g_allocs, bytes = g_alloc_bytes;
+        auto begin = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - begin;
+
+        if (!keep)
+            return;
+
+        s.us.push_back(t.count());
+        s.allocs += g_allocs - allocs;
+        s.bytes += g_alloc_bytes - bytes;
+    }
+
+    // Runs every stage of one formula iterations times, after a run that
+    // isn't timed so the glyph atlas is warm
+    bool run(const std::string &src, int iterations, draw::Backend &be, Category &c)
+    {
+        for (int i = -1; i < iterations; ++i)
+        {
+            bool keep = i >= 0;
+
+            measure(c.stages[LEX], keep, [&] {
+                Lexer lexer(src);
+                while (lexer.next_tok().type != TokenType::EOF_)
+                    ;
+            });
+
+            Ast ast;
+            layout::Layout l;
+            Image img;
+            std::vector<Uint8> data;
+
+            try
+            {
+                measure(c.stages[PARSE], keep, [&] {
+                    Parser p(src);
+                    ast = p.parse();
+                });
+
+                measure(c.stages[LAYOUT], keep, [&] {
+                    l.build(ast);
+                });
+            }
+            catch (const std::runtime_error &e)
+            {
+                std::cerr << c.name << ": " << e.what() << "\n";
+                return false;
+            }
+
+            measure(c.stages[RASTER], keep, [&] {
+                const layout::Box &b = l.box(l.root());
+                be.begin(b.w, b.h);
+                draw::raster(be, l, l.root(), { 0, 0, b.w, b.h });
+                img = be.read();
+            });
+
+            measure(c.stages[ENCODE], keep, [&] {
+                encode::save(img, data);
+            });
+        }
+
+        return true;
+    }
+
+    // Peak resident memory of the process so far in KB
+    long peak_rss()
+    {
+        rusage u;
+        getrusage(RUSAGE_SELF, &u);
+        return u.ru_maxrss;
+    }
+
+    // n levels of a formula wrapped around each other: open once per
+    // level, then the innermost part, then close once per level
+    std::string nest(size_t n, const std::string &open, const std::string &inner,
+        const std::string &close)
+    {
+        std::string s;
+        s.reserve(n * (open.size() + close.size()) + inner.size() + 1);
+        for (size_t i = 0; i < n; ++i)
+            s += open;
+        s += inner;
+        for (size_t i = 0; i < n; ++i)
+            s += close;
+        return s + '\n';
+    }
+
+    // Parses, lays out and rasterizes a formula of about mb megabytes of
+    // every shape. Deep ones must fail cleanly at the default depth limit
+    // and render with the limit lifted. Returns false if any stage fails.
+    bool stress(double mb, draw::Backend &be)
+    {
+        size_t bytes = mb * (1 << 20);
+
+        struct Input
+        {
+            const char *name;
+            std::string src;
+            bool deep;
+        };
+
+        std::string wide;
+        for (size_t i = 0; wide.size() < bytes; ++i)
+            wide += "x_{" + std::to_string(i) + "}^2 + ";
+        wide += "y\n";
+
+        Input inputs[] = {
+            { "groups", nest(bytes / 2, "{", "x", "}"), true },
+            { "fractions", nest(bytes / 10, "\\frac{a}{", "b", "}"), true },
+            { "powers", nest(bytes / 2, "x^", "y", ""), true },
+            { "wide", std::move(wide), false }
+        };
+
+        bool ok = true;
+        std::cerr << std::left << std::setw(12) << "input" << std::right << std::setw(8) << "MB"
+                  << std::setw(10) << "nodes" << std::setw(11) << "parse ms" << std::setw(11) << "layout ms"
+                  << std::setw(11) << "raster ms" << std::setw(12) << "peak MB" << "  limit\n";
+
+        for (Input &in : inputs)
+        {
+            std::string limit = "n/a";
+            try
+            {
+                Parser p(in.src);
+                p.parse();
+                limit = in.deep ? "parsed" : "ok";
+            }
+            catch (const std::runtime_error&)
+            {
+                limit = in.deep ? "ok" : "failed";
+            }
+
+            if (limit != "ok")
+                ok = false;
+
+            Samples t[STAGES];
+            Ast ast;
+            layout::Layout l;
+
+            try
+            {
+                measure(t[PARSE], true, [&] {
+                    Parser p(in.src, SIZE_MAX);
+                    ast = p.parse();
+                });
+
+                measure(t[LAYOUT], true, [&] {
+                    l.build(ast);
+                });
+
+                // The whole formula is drawn, shrunk to fit a canvas of
+                // bounded size
+                measure(t[RASTER], true, [&] {
+                    const layout::Box &b = l.box(l.root());
+                    float s = std::min({ 1.f, 4096.f / std::max(b.w, 1), 4096.f / std::max(b.h, 1) });
+                    int w = std::max(1, (int)(b.w * s)),
+                        h = std::max(1, (int)(b.h * s));
+
+                    be.begin(w, h);
+                    draw::raster(be, l, l.root(), { 0, 0, w, h });
+                    be.read();
+                });
+            }
+            catch (const std::runtime_error &e)
+            {
+                std::cerr << in.name << ": " << e.what() << "\n";
+                ok = false;
+                continue;
+            }
+
+            std::cerr << std::left << std::setw(12) << in.name << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(8) << in.src.size() / double(1 << 20)
+                      << std::setw(10) << ast.size() << std::setprecision(1)
+                      << std::setw(11) << t[PARSE].us[0] / 1000 << std::setw(11) << t[LAYOUT].us[0] / 1000
+                      << std::setw(11) << t[RASTER].us[0] / 1000
+                      << std::setw(12) << peak_rss() / 1024.0 << "  " << limit << "\n";
+        }
+
+        // Bytes no formula has must fail to parse instead of hanging
+        const std::string bad[] = {
+            std::string("a\0b\n", 4),
+            std::string("\0\n", 2),
+            std::string("\\frac{\0}{x}\n", 12)
+        };
+        for (const std::string &src : bad)
+        {
+            try
+            {
+                Parser p(src, SIZE_MAX);
+                p.parse();
+                std::cerr << "nul: parsed a formula with a NUL byte\n";
+                ok = false;
+            }
+            catch (const std::runtime_error&)
+            {
+            }
+        }
+
+        return ok;
+    }
+
+    // Times every kernel of every supported set on random pixels, then
+    // renders the corpus with every set. Returns false if any set gives
+    // different pixels than the plain C++ one.
+    bool kernels_bench(const std::vector<std::string> &paths, draw::Backend &be)
+    {
+        const size_t n = 1 << 16;
+        const int reps = 200;
+        std::mt19937 rng(1);
+
+        // Premultiplied RGBA over an opaque canvas, a quarter of it fully
+        // transparent like most of a layer
+        std::vector<Uint8> src(n * 4), dst(n * 4);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Uint8 a = rng() % 4 ? rng() % 256 : 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                src[i * 4 + c] = a ? rng() % (a + 1) : 0;
+                dst[i * 4 + c] = rng() % 256;
+            }
+            src[i * 4 + 3] = a;
+            dst[i * 4 + 3] = 255;
+        }
+
+        // ARGB8888 glyph pixels shrunk to a third
+        std::vector<Uint32> argb(n);
+        for (Uint32 &px : argb)
+            px = rng();
+
+        std::vector<int> x0(n / 3), x1(n / 3);
+        for (size_t i = 0; i < n / 3; ++i)
+        {
+            x0[i] = i * 3;
+            x1[i] = i * 3 + 3;
+        }
+
+        struct Result
+        {
+            double ns[4];
+            std::vector<Uint8> over, fill;
+            std::vector<Uint32> sums, acc;
+        };
+
+        const char *names[] = { "fill", "over", "prefix", "box" };
+        std::vector<Result> results;
+        bool ok = true;
+
+        for (const kernels::Set *k : kernels::supported())
+        {
+            Result r;
+            auto time = [&](int i, auto f) {
+                auto begin = std::chrono::steady_clock::now();
+                for (int j = 0; j < reps; ++j)
+                    f();
+                std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - begin;
+                r.ns[i] = t.count() / reps / n;
+            };
+
+            r.fill.resize(n * 4);
+            time(0, [&] { k->fill(r.fill.data(), n, 0xff000000); });
+
+            time(1, [&] {
+                r.over = dst;
+                k->over(r.over.data(), src.data(), n);
+            });
+
+            r.sums.resize((n + 1) * 4);
+            time(2, [&] { k->prefix(argb.data(), n, r.sums.data()); });
+
+            time(3, [&] {
+                r.acc.assign(x0.size() * 4, 0);
+                k->box(r.sums.data(), x0.data(), x1.data(), x0.size(), r.acc.data());
+            });
+
+            const Result &ref = results.empty() ? r : results[0];
+            bool same[4] = { r.fill == ref.fill, r.over == ref.over, r.sums == ref.sums, r.acc == ref.acc };
+
+            for (int i = 0; i < 4; ++i)
+            {
+                ok = ok && same[i];
+                std::cerr << std::left << std::setw(8) << names[i] << std::setw(8) << k->name << std::right
+                          << std::fixed << std::setprecision(3) << std::setw(9) << r.ns[i] << " ns/px"
+                          << std::setprecision(2) << std::setw(8) << ref.ns[i] / r.ns[i] << "x  "
+                          << (same[i] ? "same" : "DIFFERENT") << "\n";
+            }
+
+            results.push_back(std::move(r));
+        }
+
+        // Whole formulas, every set against the plain one, after a run that
+        // isn't timed so the glyph atlas is warm
+        const std::vector<const kernels::Set*> &sets = kernels::supported();
+        std::vector<Image> ref;
+        for (int pass = -1; pass < (int)sets.size(); ++pass)
+        {
+            const kernels::Set *k = sets[std::max(pass, 0)];
+            kernels::use(k->name);
+            double us = 0;
+            size_t formula = 0, different = 0;
+
+            for (const auto &path : paths)
+            {
+                std::ifstream ifs(path);
+                std::string line;
+                while (std::getline(ifs, line))
+                {
+                    line += '\n';
+                    try
+                    {
+                        Parser p(line);
+                        Ast ast = p.parse();
+                        layout::Layout l;
+                        l.build(ast);
+
+                        Samples t;
+                        Image img;
+                        measure(t, true, [&] {
+                            const layout::Box &b = l.box(l.root());
+                            be.begin(b.w, b.h);
+                            draw::raster(be, l, l.root(), { 0, 0, b.w, b.h });
+                            img = be.read();
+                        });
+                        us += t.us[0];
+
+                        if (pass < 0)
+                            ;
+                        else if (ref.size() <= formula)
+                            ref.push_back(std::move(img));
+                        else if (img.pixels != ref[formula].pixels)
+                            ++different;
+                        ++formula;
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                    }
+                }
+            }
+
+            if (pass < 0)
+                continue;
+
+            ok = ok && different == 0;
+            std::cerr << std::left << std::setw(8) << "raster" << std::setw(8) << k->name << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(9) << us / 1000 << " ms   "
+                      << formula << " formulas, " << different << " different\n";
+        }
+
+        kernels::use(sets.back()->name);
+        return ok;
+    }
+
+    // Draws every formula of the corpus through draw::draw, then again with
+    // a term added at the end. The second draw has to repaint less than the
+    // whole canvas and save the same file as drawing it from scratch.
+    // Returns false if any of them doesn't.
+    bool incremental(const std::vector<std::string> &paths)
+    {
+        std::string out = (fs::temp_directory_path() / "acrylic-incremental").string();
+        std::unique_ptr<draw::Backend> fresh = draw::make_cpu_backend();
+        size_t formulas = 0, whole = 0, different = 0;
+        double damaged = 0;
+
+        for (const auto &path : paths)
+        {
+            std::ifstream ifs(path);
+            std::string line;
+            while (std::getline(ifs, line))
+            {
+                if (line.empty())
+                    continue;
+
+                try
+                {
+                    // The parser borrows its source. The formula is kept wider
+                    // than what a new term spills over.
+                    std::string first = "a + b + c = " + line + '\n',
+                        second = "a + b + c = " + line + " + x\n";
+                    Parser before(first);
+                    draw::draw(before.parse(), out);
+
+                    Parser after(second);
+                    Ast ast = after.parse();
+                    draw::draw(ast, out);
+                    SDL_Rect damage = draw::damage();
+
+                    std::ifstream saved(out, std::ios::binary);
+                    std::vector<Uint8> got((std::istreambuf_iterator<char>(saved)), {}), want;
+                    Image img = draw::render(*fresh, ast);
+                    encode::save(img, want);
+
+                    if (damage.w >= img.w && damage.h >= img.h)
+                        ++whole;
+                    if (got != want)
+                        ++different;
+                    damaged += (double)damage.w * damage.h / ((double)img.w * img.h);
+                    ++formulas;
+                }
+                catch (const std::runtime_error&)
+                {
+                }
+            }
+        }
+
+        fs::remove(out);
+        std::cerr << formulas << " edits, " << std::fixed << std::setprecision(1)
+                  << (formulas ? 100 * damaged / formulas : 0) << "% of the canvas repainted on average, "
+                  << whole << " repainted whole, " << different << " different\n";
+        return formulas > 0 && whole == 0 && different == 0;
+    }
+
+    void print_table(const std::vector<Category> &categories, int iterations)
+    {
+        std::cerr << iterations << " iterations per formula, times in microseconds\n"
+                  << std::left << std::setw(12) << "corpus" << std::setw(8) << "stage" << std::right
+                  << std::setw(11) << "p50" << std::setw(11) << "p90" << std::setw(11) << "p99"
+                  << std::setw(11) << "max" << std::setw(11) << "allocs" << std::setw(11) << "KB" << "\n";
+
+        for (const auto &c : categories)
+        {
+            for (int s = 0; s < STAGES; ++s)
+            {
+                const Samples &st = c.stages[s];
+                size_t runs = std::max<size_t>(st.us.size(), 1);
+
+                std::cerr << std::left << std::setw(12) << c.name << std::setw(8) << g_stage_names[s]
+                          << std::right << std::fixed << std::setprecision(1)
+                          << std::setw(11) << st.percentile(.5) << std::setw(11) << st.percentile(.9)
+                          << std::setw(11) << st.percentile(.99) << std::setw(11) << st.percentile(1)
+                          << std::setw(11) << st.allocs / runs
+                          << std::setw(11) << st.bytes / runs / 1024.0 << "\n";
+            }
+        }
+    }
+
+    void print_json(std::ostream &out, const std::vector<Category> &categories, int iterations)
+    {
+        out << std::fixed << std::setprecision(3)
+            << "{\n  \"version\": \"" << ACRYLIC_VERSION << "\",\n"
+            << "  \"iterations\": " << iterations << ",\n"
+            << "  \"corpora\": [\n";
+
+        for (size_t i = 0; i < categories.size(); ++i)
+        {
+            const Category &c = categories[i];
+            out << "    {\n      \"name\": \"" << c.name << "\",\n"
+                << "      \"formulas\": " << c.formulas << ",\n"
+                << "      \"failed\": " << c.failed << ",\n"
+                << "      \"stages\": {\n";
+
+            for (int s = 0; s < STAGES; ++s)
+            {
+                const Samples &st = c.stages[s];
+                size_t runs = std::max<size_t>(st.us.size(), 1);
+
+                out << "        \"" << g_stage_names[s] << "\": { "
+                    << "\"p50_us\": " << st.percentile(.5) << ", "
+                    << "\"p90_us\": " << st.percentile(.9) << ", "
+                    << "\"p99_us\": " << st.percentile(.99) << ", "
+                    << "\"max_us\": " << st.percentile(1) << ", "
+                    << "\"mean_us\": " << st.mean() << ", "
+                    << "\"allocs\": " << st.allocs / runs << ", "
+                    << "\"bytes\": " << st.bytes / runs << " }"
+                    << (s + 1 < STAGES ? ",\n" : "\n");
+            }
+
+            out << "      }\n    }" << (i + 1 < categories.size() ? ",\n" : "\n");
+        }
+
+        out << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20;
+    bool stress_test = false,
+        kernel_test = false,
+        incremental_test = false;
+    double mb = 1;
+    std::string json;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = std::max(1, std::stoi(argv[++i]));
+        else if (strcmp(argv[i], "--stress") == 0)
+            stress_test = true;
+        else if (strcmp(argv[i], "--kernels") == 0)
+            kernel_test = true;
+        else if (strcmp(argv[i], "--incremental") == 0)
+            incremental_test = true;
+        else if (strcmp(argv[i], "--mb") == 0 && i + 1 < argc)
+            mb = std::stod(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else
+            paths.push_back(argv[i]);
+    }
+
+    if (stress_test)
+    {
+        draw::init("cpu");
+        std::unique_ptr<draw::Backend> be = draw::make_cpu_backend();
+        bool ok = stress(mb, *be);
+
+        be.reset();
+        draw::quit();
+        return ok ? 0 : EXIT_FAILURE;
+    }
+
+    if (paths.empty())
+    {
+        std::error_code ec;
+        for (const auto &e : fs::directory_iterator("bench/corpus", ec))
+        {
+            if (e.path().extension() == ".txt")
+                paths.push_back(e.path().string());
+        }
+
+        std::sort(paths.begin(), paths.end());
+    }
+
+    if (paths.empty())
+    {
+        std::cerr << "No corpus found, run from the repository root or pass corpus files.\n";
+        return EXIT_FAILURE;
+    }
+
+    if (kernel_test)
+    {
+        draw::init("cpu");
+        std::unique_ptr<draw::Backend> be = draw::make_cpu_backend();
+        bool ok = kernels_bench(paths, *be);
+
+        be.reset();
+        draw::quit();
+        return ok ? 0 : EXIT_FAILURE;
+    }
+
+    if (incremental_test)
+    {
+        draw::init("cpu", 1);
+        bool ok = incremental(paths);
+
+        draw::quit();
+        return ok ? 0 : EXIT_FAILURE;
+    }
+
+    draw::init("cpu");
+    std::unique_ptr<draw::Backend> be = draw::make_cpu_backend();
+
+    std::vector<Category> categories;
+    for (const auto &path : paths)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+        {
+            std::cerr << "Couldn't open '" << path << "'.\n";
+            continue;
+        }
+
+        Category c;
+        c.name = fs::path(path).stem().string();
+
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            if (line.empty())
+                continue;
+
+            if (run(line + '\n', iterations, *be, c))
+                ++c.formulas;
+            else
+                ++c.failed;
+        }
+
+        for (auto &s : c.stages)
+            std::sort(s.us.begin(), s.us.end());
+
+        categories.push_back(std::move(c));
+    }
+
+    be.reset();
+    draw::quit();
+
+    print_table(categories, iterations);
+
+    if (json.empty() || json == "-")
+    {
+        print_json(std::cout, categories, iterations);
+    }
+    else
+    {
+        std::ofstream ofs(json);
+        print_json(ofs, categories, iterations);
+        std::cerr << "Results written to '" << json << "'.\n";
+    }
+
+    return 0;
+}
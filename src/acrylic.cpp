@@ -0,0 +1,58 @@
+#include "acrylic.h"
+#include "parser.h"
+#include "draw.h"
+#include <stdexcept>
+
+namespace
+{
+    Ast parse(std::string_view formula, const acrylic::Options &opts)
+    {
+        // The parser expects the last line to end like every other one
+        std::string src(formula);
+        src += '\n';
+
+        Parser p(src, opts.max_depth ? opts.max_depth : g_max_depth);
+        return p.parse();
+    }
+}
+
+acrylic::Context::Context(const std::string &backend)
+{
+    if (backend != "cpu" && backend != "svg")
+        throw std::runtime_error("Backend '" + backend + "' can't be used by a context");
+
+    draw::open();
+    m_backend = draw::make_backend(backend);
+}
+
+acrylic::Context::~Context()
+{
+    m_backend.reset();
+    draw::close();
+}
+
+Image acrylic::Context::render(std::string_view formula, const Options &opts)
+{
+    if (m_backend->vector())
+        throw std::runtime_error("The svg backend has no pixels to read");
+
+    return draw::render(*m_backend, parse(formula, opts), opts.threads);
+}
+
+std::vector<Uint8> acrylic::Context::render_file(std::string_view formula,
+    const encode::Options &enc, const Options &opts)
+{
+    Ast ast = parse(formula, opts);
+    layout::Layout l(m_backend->vector());
+    l.build(ast);
+    const layout::Box &b = l.box(l.root());
+
+    m_backend->begin(b.w, b.h);
+    draw::raster_parallel(*m_backend, l, l.root(), { 0, 0, b.w, b.h }, opts.threads);
+
+    std::vector<Uint8> out;
+    if (!m_backend->save(out, enc))
+        throw std::runtime_error("Couldn't encode the image");
+
+    return out;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "image.h"
+#include "encode.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <string_view>
+
+namespace draw { class Backend; }
+
+// Renders formulas in another program's process. Build libacrylic.a with
+// `make lib` and link it with SDL2, SDL2_image, SDL2_ttf and zlib.
+//
+// Every Context owns its backend and the canvases and layers it keeps for
+// reuse, so threads that each have their own Context render without
+// waiting on each other. The font and glyph atlas are shared by all of
+// them, opened by the first Context and freed with the last. Errors are
+// thrown as std::runtime_error, nothing exits the process.
+namespace acrylic
+{
+    struct Options
+    {
+        // Threads drawing one formula, the canvas is split between them
+        size_t threads{ 1 };
+        // Deepest nesting the formula may have, 0 for the --max-depth default
+        size_t max_depth{ 0 };
+    };
+
+    class Context
+    {
+    public:
+        // backend is "cpu" or "svg", the sdl one needs the main thread
+        explicit Context(const std::string &backend = "cpu");
+        ~Context();
+
+        Context(const Context&) = delete;
+        Context &operator=(const Context&) = delete;
+
+        // The formula as RGBA pixels, a line break starts a new row. Not
+        // available with the svg backend.
+        Image render(std::string_view formula, const Options &opts = Options());
+        // The formula encoded as a file would be saved, an SVG document
+        // with the svg backend which ignores enc
+        std::vector<Uint8> render_file(std::string_view formula,
+            const encode::Options &enc = encode::Options(), const Options &opts = Options());
+
+    private:
+        std::unique_ptr<draw::Backend> m_backend;
+    };
+}
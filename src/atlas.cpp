@@ -0,0 +1,180 @@
+#include "atlas.h"
+#include "trace.h"
+#include <mutex>
+
+// Held around every call into a TTF_Font, the atlas and the metrics
+// functions share fonts and TTF_Font isn't thread safe
+static std::mutex g_font_mutex;
+
+static Uint64 glyph_key(int size, Uint32 cp)
+{
+    return (Uint64)size << 32 | cp;
+}
+
+static Uint64 kerning_key(int size, Uint32 prev, Uint32 cp)
+{
+    return (Uint64)size << 42 | (Uint64)prev << 21 | cp;
+}
+
+Atlas::Atlas(int page_size)
+    : m_page_size(page_size)
+{
+}
+
+Atlas::~Atlas()
+{
+    clear();
+}
+
+const Glyph &Atlas::glyph(TTF_Font *font, int size, Uint32 cp)
+{
+    Uint64 key = glyph_key(size, cp);
+
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        auto it = m_glyphs.find(key);
+        if (it != m_glyphs.end())
+            return it->second;
+    }
+
+    // TTF_Font isn't thread safe either, so rasterize under the same lock
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_glyphs.find(key);
+    if (it != m_glyphs.end())
+        return it->second;
+
+    trace::count(trace::Counter::GLYPHS);
+
+    Glyph g;
+    g.cp = cp;
+    g.size = size;
+    SDL_Surface *surf;
+    {
+        std::lock_guard<std::mutex> font_lock(g_font_mutex);
+        int miny, maxy;
+        TTF_GlyphMetrics32(font, cp, &g.minx, &g.maxx, &miny, &maxy, &g.advance);
+        g.offset = std::min(0, g.minx);
+
+        surf = TTF_RenderGlyph32_Blended(font, cp, { 0, 0, 0 });
+    }
+    if (surf)
+    {
+        g.src = pack(surf->w, surf->h, g.page);
+
+        SDL_Rect dst = g.src;
+        SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(surf, 0, m_pages[g.page].surf, &dst);
+        m_pages[g.page].version = ++m_version;
+
+        SDL_FreeSurface(surf);
+    }
+
+    return m_glyphs.emplace(key, g).first->second;
+}
+
+int Atlas::kerning(TTF_Font *font, int size, Uint32 prev, Uint32 cp)
+{
+    Uint64 key = kerning_key(size, prev, cp);
+
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        auto it = m_kerning.find(key);
+        if (it != m_kerning.end())
+            return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    int k = kerning_metrics(font, prev, cp);
+    m_kerning.emplace(key, k);
+    return k;
+}
+
+Glyph glyph_metrics(TTF_Font *font, int size, Uint32 cp)
+{
+    Glyph g;
+    g.cp = cp;
+    g.size = size;
+
+    std::lock_guard<std::mutex> lock(g_font_mutex);
+    int miny, maxy;
+    TTF_GlyphMetrics32(font, cp, &g.minx, &g.maxx, &miny, &maxy, &g.advance);
+    g.offset = std::min(0, g.minx);
+    g.src = { 0, 0, std::max(g.maxx, g.advance) - g.offset, TTF_FontHeight(font) };
+
+    return g;
+}
+
+int kerning_metrics(TTF_Font *font, Uint32 prev, Uint32 cp)
+{
+    std::lock_guard<std::mutex> lock(g_font_mutex);
+    return TTF_GetFontKerningSizeGlyphs32(font, prev, cp);
+}
+
+int metrics_run_width(TTF_Font *font, int size, const std::u32string &s)
+{
+    return metrics_run(font, size, s, [](const Glyph &, int) {});
+}
+
+int Atlas::run_width(TTF_Font *font, int size, const std::u32string &s)
+{
+    return run(font, size, s, [](const Glyph &, int) {});
+}
+
+SDL_Surface *Atlas::page(size_t page) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_pages[page].surf;
+}
+
+unsigned Atlas::version(size_t page) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_pages[page].version;
+}
+
+void Atlas::clear()
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    for (auto &p : m_pages)
+        SDL_FreeSurface(p.surf);
+
+    m_pages.clear();
+    m_glyphs.clear();
+    m_kerning.clear();
+}
+
+SDL_Rect Atlas::pack(int w, int h, size_t &page)
+{
+    // Keep a 1px gutter so filtering never bleeds in the neighbours
+    int pw = w + 1,
+        ph = h + 1;
+
+    if (!m_pages.empty())
+    {
+        Page &p = m_pages.back();
+
+        if (p.x + pw > p.surf->w)
+        {
+            p.x = 0;
+            p.y += p.shelf_h;
+            p.shelf_h = 0;
+        }
+
+        if (p.x + pw <= p.surf->w && p.y + ph <= p.surf->h)
+        {
+            SDL_Rect r = { p.x, p.y, w, h };
+            p.x += pw;
+            p.shelf_h = std::max(p.shelf_h, ph);
+            page = m_pages.size() - 1;
+            return r;
+        }
+    }
+
+    Page p;
+    p.surf = SDL_CreateRGBSurfaceWithFormat(0,
+        std::max(m_page_size, pw), std::max(m_page_size, ph),
+        32, SDL_PIXELFORMAT_ARGB8888);
+    m_pages.emplace_back(p);
+
+    return pack(w, h, page);
+}
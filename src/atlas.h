@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <shared_mutex>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+struct Glyph
+{
+    // Kept for backends that draw text rather than the bitmap
+    Uint32 cp{ 0 };
+    int size{ 0 };
+
+    size_t page{ 0 };
+    SDL_Rect src{ 0, 0, 0, 0 };
+
+    // Pen offset of the left edge of src
+    int offset{ 0 };
+    int minx{ 0 }, maxx{ 0 }, advance{ 0 };
+};
+
+// Metrics of a glyph read straight from the font, for backends that draw
+// text instead of bitmaps. Nothing is rasterized or cached, src is only the
+// size the bitmap would have. Safe to call from any thread.
+Glyph glyph_metrics(TTF_Font *font, int size, Uint32 cp);
+int kerning_metrics(TTF_Font *font, Uint32 prev, Uint32 cp);
+
+// Lays out a run the same way TTF_RenderText does with the glyphs glyph(cp)
+// and the kerning kerning(prev, cp) return, calling f(glyph, x) with the
+// left edge of every glyph. Returns the width of the run.
+template <typename G, typename K, typename F>
+int lay_out_run(const std::u32string &s, G glyph, K kerning, F f);
+
+// Same as Atlas::run, but with glyph_metrics and without touching an atlas
+template <typename F>
+int metrics_run(TTF_Font *font, int size, const std::u32string &s, F f);
+int metrics_run_width(TTF_Font *font, int size, const std::u32string &s);
+
+// Persistent cache of rasterized glyphs keyed by (codepoint, size). Glyphs
+// are packed into surface pages on the cpu, backends that need textures
+// upload a page again whenever its version changes. Safe to share between
+// threads.
+class Atlas
+{
+public:
+    Atlas(int page_size = 1024);
+    ~Atlas();
+
+    const Glyph &glyph(TTF_Font *font, int size, Uint32 cp);
+    int kerning(TTF_Font *font, int size, Uint32 prev, Uint32 cp);
+
+    // Lays out a run the same way TTF_RenderText does, calling f(glyph, x)
+    // with the left edge of every glyph. Returns the width of the run.
+    template <typename F>
+    int run(TTF_Font *font, int size, const std::u32string &s, F f);
+    int run_width(TTF_Font *font, int size, const std::u32string &s);
+
+    SDL_Surface *page(size_t page) const;
+    unsigned version(size_t page) const;
+
+    void clear();
+
+private:
+    struct Page
+    {
+        SDL_Surface *surf{ nullptr };
+        unsigned version{ 0 };
+
+        // Shelf packer
+        int x{ 0 }, y{ 0 }, shelf_h{ 0 };
+    };
+
+    SDL_Rect pack(int w, int h, size_t &page);
+
+private:
+    int m_page_size;
+    std::vector<Page> m_pages;
+    std::unordered_map<Uint64, Glyph> m_glyphs;
+    std::unordered_map<Uint64, int> m_kerning;
+
+    // Never reused, even across clear, so a stale upload can't look current
+    unsigned m_version{ 0 };
+
+    mutable std::shared_mutex m_mutex;
+};
+
+template <typename G, typename K, typename F>
+int lay_out_run(const std::u32string &s, G glyph, K kerning, F f)
+{
+    if (s.empty())
+        return 0;
+
+    // Shift the run right if the first glyph hangs left of the pen
+    int origin = std::min(0, glyph(s[0]).minx);
+    int pen = 0,
+        minx = origin,
+        maxx = 0;
+    Uint32 prev = 0;
+
+    for (Uint32 cp : s)
+    {
+        if (prev)
+            pen += kerning(prev, cp);
+
+        const Glyph &g = glyph(cp);
+        minx = std::min(minx, pen + g.minx);
+        maxx = std::max(maxx, pen + std::max(g.maxx, g.advance));
+        f(g, pen + g.offset - origin);
+
+        pen += g.advance;
+        prev = cp;
+    }
+
+    return maxx - minx;
+}
+
+template <typename F>
+int Atlas::run(TTF_Font *font, int size, const std::u32string &s, F f)
+{
+    return lay_out_run(s,
+        [&](Uint32 cp) -> const Glyph & { return glyph(font, size, cp); },
+        [&](Uint32 prev, Uint32 cp) { return kerning(font, size, prev, cp); },
+        f);
+}
+
+template <typename F>
+int metrics_run(TTF_Font *font, int size, const std::u32string &s, F f)
+{
+    return lay_out_run(s,
+        [&](Uint32 cp) { return glyph_metrics(font, size, cp); },
+        [&](Uint32 prev, Uint32 cp) { return kerning_metrics(font, prev, cp); },
+        f);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "atlas.h"
+#include "image.h"
+#include "path.h"
+#include "encode.h"
+#include <memory>
+#include <string>
+#include <SDL2/SDL.h>
+
+namespace draw
+{
+    // Target of a rasterization pass, everything is drawn in black on a
+    // white canvas.
+    class Backend
+    {
+    public:
+        virtual ~Backend() = default;
+
+        // Starts a new white canvas
+        virtual void begin(int w, int h) = 0;
+
+        // Changes the canvas size, keeping what's drawn where it still fits.
+        // Returns false if the canvas had to be started over instead, then
+        // everything has to be drawn again.
+        virtual bool resize(int w, int h) { begin(w, h); return false; }
+        // Paints r white and keeps all drawing inside of it until the next
+        // repaint or begin
+        virtual void repaint(const SDL_Rect &r) = 0;
+
+        virtual void glyph(const Glyph &g, const SDL_Rect &dst) = 0;
+        // Fills p in black, its points are in canvas pixels
+        virtual void path(const path::Path &p) = 0;
+        virtual void fill(const SDL_Rect &r) = 0;
+        virtual void line(int x1, int y1, int x2, int y2) = 0;
+
+        // Layers are transparent canvases covering part of this one. They
+        // can be drawn on from other threads and are composited back in
+        // the order the caller chooses.
+        virtual bool supports_layers() const { return false; }
+        virtual std::unique_ptr<Backend> layer(const SDL_Rect &area) { return nullptr; }
+        virtual void composite(const Backend &layer) {}
+
+        // Shows the canvas, only does something for windowed backends
+        virtual void present() {}
+
+        // Hands over the finished canvas, it can't be drawn on afterwards
+        // until the next begin
+        virtual Image read() = 0;
+        // Same as read, but the canvas stays to be drawn on further
+        virtual Image copy() { return read(); }
+
+        // Vector backends have no pixels to read, they save a document of
+        // their own instead
+        virtual bool vector() const { return false; }
+        // Same as read, but encoded and appended to out. Vector backends
+        // ignore opts.
+        virtual bool save(std::vector<Uint8> &out, const encode::Options &opts = encode::g_options)
+        {
+            return encode::save(read(), out, opts);
+        }
+        // Extension of what save produces, without the dot
+        virtual const char *extension() const { return encode::extension(encode::g_options.format); }
+    };
+
+    // Windowed SDL renderer, used for the interactive and emscripten builds
+    std::unique_ptr<Backend> make_sdl_backend();
+    // In-memory rasterizer, needs no window, renderer or display
+    std::unique_ptr<Backend> make_cpu_backend();
+    // Writes an SVG document with text, rects and lines instead of pixels
+    std::unique_ptr<Backend> make_svg_backend();
+
+    // Returns nullptr if there is no backend called name
+    std::unique_ptr<Backend> make_backend(const std::string &name);
+}
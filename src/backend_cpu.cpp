@@ -0,0 +1,412 @@
+#include "backend.h"
+#include "trace.h"
+#include "pool.h"
+#include "kernels.h"
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+extern Atlas g_atlas;
+
+// Pixel buffers of canvases and layers, shared by a canvas and its layers
+using Buffers = pool::Pool<std::vector<Uint8>>;
+
+namespace
+{
+    // The 4 bytes of an RGBA pixel as kernels::Set::fill takes them
+    Uint32 rgba(Uint8 r, Uint8 g, Uint8 b, Uint8 a)
+    {
+        Uint8 px[4] = { r, g, b, a };
+        Uint32 v;
+        memcpy(&v, px, 4);
+        return v;
+    }
+}
+
+class CpuBackend : public draw::Backend
+{
+public:
+    CpuBackend()
+        : m_buffers(std::make_shared<Buffers>([](std::vector<Uint8> &v) {
+            trace::count(trace::Counter::TEXTURE_BYTES, -(int64_t)v.capacity());
+            v = {};
+        }))
+    {
+    }
+
+    ~CpuBackend()
+    {
+        recycle();
+        trace::count(trace::Counter::TEXTURE_BYTES, -m_accounted);
+    }
+
+    void begin(int w, int h) override
+    {
+        m_area = { 0, 0, w, h };
+        m_clip = m_area;
+        m_stride = w;
+
+        // The canvas leaves with the image read hands out, so it isn't
+        // worth rounding up to be pooled
+        if (m_pooled)
+            recycle();
+        m_pixels.assign((size_t)w * h * 4, 255);
+        account();
+    }
+
+    // Rows keep some room to the right so a formula that grows while it's
+    // typed doesn't move the whole canvas for every character
+    bool resize(int w, int h) override
+    {
+        // Nothing to keep once the canvas has been read
+        if (m_pixels.empty() || m_area.x || m_area.y)
+        {
+            begin(w, h);
+            return false;
+        }
+
+        int rows = m_pixels.size() / 4 / m_stride;
+        if (w > m_stride || h > rows)
+        {
+            int stride = w > m_stride ? std::max(w, m_stride * 3 / 2) : m_stride,
+                nrows = h > rows ? std::max(h, rows * 3 / 2) : rows;
+
+            std::vector<Uint8> pixels((size_t)stride * nrows * 4, 255);
+            for (int y = 0; y < std::min(h, m_area.h); ++y)
+                std::copy_n(at(0, y), (size_t)m_area.w * 4, &pixels[(size_t)y * stride * 4]);
+
+            // Grown buffers aren't of any size class
+            if (m_pooled)
+                m_buffers->forget(m_pooled);
+            m_pooled = 0;
+
+            m_pixels = std::move(pixels);
+            m_stride = stride;
+            account();
+        }
+
+        m_area = m_clip = { 0, 0, w, h };
+        return true;
+    }
+
+    void repaint(const SDL_Rect &r) override
+    {
+        if (!SDL_IntersectRect(&r, &m_area, &m_clip))
+            m_clip = { 0, 0, 0, 0 };
+
+        const kernels::Set &k = kernels::get();
+        for (int y = m_clip.y; y < m_clip.y + m_clip.h; ++y)
+            k.fill(at(m_clip.x, y), m_clip.w, rgba(255, 255, 255, 255));
+    }
+
+    bool supports_layers() const override { return true; }
+
+    std::unique_ptr<draw::Backend> layer(const SDL_Rect &area) override
+    {
+        std::unique_ptr<CpuBackend> layer(new CpuBackend(m_buffers));
+        if (!SDL_IntersectRect(&area, &m_clip, &layer->m_area))
+            layer->m_area = { 0, 0, 0, 0 };
+        layer->m_clip = layer->m_area;
+        layer->m_stride = layer->m_area.w;
+
+        layer->pooled_pixels((size_t)layer->m_area.w * layer->m_area.h * 4);
+        return layer;
+    }
+
+    void composite(const draw::Backend &be) override
+    {
+        const CpuBackend &layer = static_cast<const CpuBackend&>(be);
+        const SDL_Rect &r = layer.m_area;
+
+        const kernels::Set &k = kernels::get();
+        for (int y = r.y; y < r.y + r.h; ++y)
+            k.over(at(r.x, y), layer.at(r.x, y), r.w);
+    }
+
+    void glyph(const Glyph &g, const SDL_Rect &dst) override
+    {
+        blend(g_atlas.page(g.page), g.src, dst);
+    }
+
+    void path(const path::Path &p) override
+    {
+        SDL_Rect bounds = p.bounds(), area;
+        if (!SDL_IntersectRect(&bounds, &m_clip, &area))
+            return;
+
+        path::rasterize(p, area, m_coverage);
+        // Black at the covered fraction, premultiplied, so only alpha changes
+        m_row.assign((size_t)area.w * 4, 0);
+
+        const kernels::Set &k = kernels::get();
+        for (int y = 0; y < area.h; ++y)
+        {
+            const Uint8 *cov = &m_coverage[(size_t)y * area.w];
+            for (int x = 0; x < area.w; ++x)
+                m_row[(size_t)x * 4 + 3] = cov[x];
+
+            k.over(at(area.x, area.y + y), m_row.data(), area.w);
+        }
+    }
+
+    void fill(const SDL_Rect &r) override
+    {
+        SDL_Rect clip;
+        if (!SDL_IntersectRect(&r, &m_clip, &clip))
+            return;
+
+        const kernels::Set &k = kernels::get();
+        for (int y = clip.y; y < clip.y + clip.h; ++y)
+            k.fill(at(clip.x, y), clip.w, rgba(0, 0, 0, 255));
+    }
+
+    // Bresenham, matches SDL_RenderDrawLine including both end points
+    void line(int x1, int y1, int x2, int y2) override
+    {
+        // Rules are lines along an axis, those cover a rect
+        if (x1 == x2 || y1 == y2)
+        {
+            fill({ std::min(x1, x2), std::min(y1, y2), std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1 });
+            return;
+        }
+
+        int dx = std::abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+        int dy = -std::abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+        int err = dx + dy;
+
+        while (true)
+        {
+            plot(x1, y1);
+            if (x1 == x2 && y1 == y2)
+                break;
+
+            int e2 = 2 * err;
+            if (e2 >= dy) { err += dy; x1 += sx; }
+            if (e2 <= dx) { err += dx; y1 += sy; }
+        }
+    }
+
+    Image read() override
+    {
+        trace::Scope scope("readback");
+
+        Image img;
+        img.w = m_area.w;
+        img.h = m_area.h;
+
+        if (m_stride == m_area.w)
+        {
+            m_pixels.resize((size_t)m_area.w * m_area.h * 4);
+            img.pixels = std::move(m_pixels);
+
+            // The buffer leaves with the image
+            if (m_pooled)
+                m_buffers->forget(m_pooled);
+            m_pooled = 0;
+        }
+        else
+        {
+            copy_rows(img);
+        }
+
+        recycle();
+        return img;
+    }
+
+    Image copy() override
+    {
+        trace::Scope scope("readback");
+
+        Image img;
+        img.w = m_area.w;
+        img.h = m_area.h;
+        copy_rows(img);
+        return img;
+    }
+
+private:
+    explicit CpuBackend(std::shared_ptr<Buffers> buffers)
+        : m_buffers(std::move(buffers))
+    {
+    }
+
+    void copy_rows(Image &img) const
+    {
+        img.pixels.resize((size_t)m_area.w * m_area.h * 4);
+        for (int y = 0; y < m_area.h; ++y)
+            std::copy_n(at(0, y), (size_t)m_area.w * 4, &img.pixels[(size_t)y * m_area.w * 4]);
+    }
+
+    // Makes m_pixels n transparent bytes in a buffer from the pool, for a
+    // new layer
+    void pooled_pixels(size_t n)
+    {
+        size_t size = pool::size_class(n);
+        bool made = false;
+        m_pixels = m_buffers->get(size, size, [size, &made] {
+            trace::count(trace::Counter::TEXTURES);
+            made = true;
+
+            std::vector<Uint8> v;
+            v.reserve(size);
+            return v;
+        });
+
+        // Pooled buffers are still counted from when they were made
+        if (!made)
+            m_accounted += m_pixels.capacity();
+        m_pooled = size;
+
+        m_pixels.assign(n, 0);
+        account();
+    }
+
+    // Gives the buffer back to the pool, or frees it if it didn't come from
+    // there
+    void recycle()
+    {
+        if (!m_pooled)
+        {
+            m_pixels = {};
+            account();
+            return;
+        }
+
+        // The pool counts the buffer from here on
+        m_accounted -= m_pixels.capacity();
+        m_buffers->put(m_pooled, m_pooled, std::move(m_pixels));
+        m_pixels = {};
+        m_pooled = 0;
+    }
+
+    // Tells trace how much memory the canvas holds whenever that changes
+    void account()
+    {
+        int64_t bytes = m_pixels.capacity();
+        trace::count(trace::Counter::TEXTURE_BYTES, bytes - m_accounted);
+        m_accounted = bytes;
+    }
+
+    Uint8 *at(int x, int y)
+    {
+        return &m_pixels[((size_t)(y - m_area.y) * m_stride + (x - m_area.x)) * 4];
+    }
+
+    const Uint8 *at(int x, int y) const
+    {
+        return &m_pixels[((size_t)(y - m_area.y) * m_stride + (x - m_area.x)) * 4];
+    }
+
+    void plot(int x, int y)
+    {
+        if (x < m_clip.x || y < m_clip.y || x >= m_clip.x + m_clip.w || y >= m_clip.y + m_clip.h)
+            return;
+
+        Uint8 *p = at(x, y);
+        p[0] = p[1] = p[2] = 0;
+        p[3] = 255;
+    }
+
+    // Stretches srect of an ARGB8888 surface over drect with a box filter and
+    // composites it over the canvas. A row of source pixels is summed up
+    // once, then every destination pixel takes the sum of its box out of it.
+    void blend(const SDL_Surface *src, const SDL_Rect &srect, const SDL_Rect &drect)
+    {
+        if (drect.w <= 0 || drect.h <= 0 || srect.w <= 0 || srect.h <= 0)
+            return;
+
+        SDL_Rect clip;
+        if (!SDL_IntersectRect(&drect, &m_clip, &clip))
+            return;
+
+        int x0 = clip.x, x1 = clip.x + clip.w;
+        int y0 = clip.y, y1 = clip.y + clip.h;
+        size_t w = clip.w;
+
+        // Source columns of every destination column, from the first one
+        int left = srect.x + (x0 - drect.x) * srect.w / drect.w;
+        m_box_x0.resize(w);
+        m_box_x1.resize(w);
+        for (int x = x0; x < x1; ++x)
+        {
+            int sx0 = srect.x + (x - drect.x) * srect.w / drect.w;
+            int sx1 = std::max(sx0 + 1, srect.x + (x + 1 - drect.x) * srect.w / drect.w);
+            m_box_x0[x - x0] = sx0 - left;
+            m_box_x1[x - x0] = sx1 - left;
+        }
+
+        size_t span = m_box_x1[w - 1];
+        m_sums.resize((span + 1) * 4);
+        m_acc.resize(w * 4);
+
+        const kernels::Set &k = kernels::get();
+        // Source row m_sums holds, rows are shared by neighbours when
+        // stretching
+        int summed = -1;
+
+        for (int y = y0; y < y1; ++y)
+        {
+            int sy0 = srect.y + (y - drect.y) * srect.h / drect.h;
+            int sy1 = std::max(sy0 + 1, srect.y + (y + 1 - drect.y) * srect.h / drect.h);
+
+            // Premultiplied colour summed over every box
+            std::fill(m_acc.begin(), m_acc.end(), 0);
+            for (int j = sy0; j < sy1; ++j)
+            {
+                if (j != summed)
+                {
+                    const Uint32 *row = (const Uint32*)((const Uint8*)src->pixels + j * src->pitch);
+                    k.prefix(row + left, span, m_sums.data());
+                    summed = j;
+                }
+
+                k.box(m_sums.data(), m_box_x0.data(), m_box_x1.data(), w, m_acc.data());
+            }
+
+            for (size_t i = 0; i < w; ++i)
+            {
+                const Uint32 *s = &m_acc[i * 4];
+                Uint32 r = s[0], g = s[1], b = s[2], a = s[3];
+                if (a == 0)
+                    continue;
+
+                Uint32 n = (Uint32)(m_box_x1[i] - m_box_x0[i]) * (sy1 - sy0);
+                Uint8 *p = at(x0 + i, y);
+                Uint32 inv = 255 * n - a;
+                p[0] = (r / 255 + p[0] * inv / 255) / n;
+                p[1] = (g / 255 + p[1] * inv / 255) / n;
+                p[2] = (b / 255 + p[2] * inv / 255) / n;
+                p[3] = (a + p[3] * inv / 255) / n;
+            }
+        }
+    }
+
+private:
+    // Part of the image this canvas covers, the whole image unless it's a layer
+    SDL_Rect m_area{ 0, 0, 0, 0 };
+    // Drawing is limited to this part of m_area
+    SDL_Rect m_clip{ 0, 0, 0, 0 };
+    // Pixels from one row to the next, can be more than m_area.w
+    int m_stride{ 0 };
+
+    // Premultiplied RGBA, always opaque outside of layers
+    std::vector<Uint8> m_pixels;
+    // Bytes last reported to trace
+    int64_t m_accounted{ 0 };
+
+    std::shared_ptr<Buffers> m_buffers;
+    // Size class of m_pixels if it came from m_buffers and goes back there
+    size_t m_pooled{ 0 };
+
+    // Scratch space of blend, kept to not allocate for every glyph
+    std::vector<int> m_box_x0, m_box_x1;
+    std::vector<Uint32> m_sums, m_acc;
+    // Scratch space of path
+    std::vector<Uint8> m_coverage, m_row;
+};
+
+std::unique_ptr<draw::Backend> draw::make_cpu_backend()
+{
+    return std::make_unique<CpuBackend>();
+}
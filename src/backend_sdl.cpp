@@ -0,0 +1,273 @@
+#include "backend.h"
+#include "trace.h"
+#include "pool.h"
+#include <vector>
+#include <algorithm>
+
+extern Atlas g_atlas;
+
+class SdlBackend : public draw::Backend
+{
+public:
+    SdlBackend()
+        : m_targets([this](SDL_Texture *&tex) { destroy(tex); })
+    {
+        SDL_Init(SDL_INIT_VIDEO);
+        m_win = SDL_CreateWindow("Acrylic",
+            SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            800, 600,
+#ifdef __EMSCRIPTEN__
+            SDL_WINDOW_SHOWN
+#else
+            SDL_WINDOW_HIDDEN
+#endif
+        );
+        m_rend = SDL_CreateRenderer(m_win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+        SDL_SetRenderDrawColor(m_rend, 255, 255, 255, 255);
+        SDL_RenderClear(m_rend);
+    }
+
+    ~SdlBackend()
+    {
+        if (m_tex) destroy(m_tex);
+        m_targets.clear();
+        for (auto &p : m_pages)
+        {
+            if (p.tex) destroy(p.tex);
+        }
+        if (m_mask) destroy(m_mask);
+
+        SDL_DestroyRenderer(m_rend);
+        SDL_DestroyWindow(m_win);
+        SDL_Quit();
+    }
+
+    // Canvases come from a pool of targets in a few sizes, so the next
+    // formula usually draws on the texture the last one was read from
+    void begin(int w, int h) override
+    {
+        if (m_tex)
+            m_targets.put(m_key, (size_t)m_cap_w * m_cap_h * 4, m_tex);
+
+        m_cap_w = pool::size_class(std::max(w, 1));
+        m_cap_h = pool::size_class(std::max(h, 1));
+        m_key = (size_t)m_cap_w << 16 | m_cap_h;
+        m_tex = m_targets.get(m_key, (size_t)m_cap_w * m_cap_h * 4, [&] {
+            return create(SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, m_cap_w, m_cap_h);
+        });
+        m_w = w;
+        m_h = h;
+
+        target(m_tex);
+        SDL_RenderSetClipRect(m_rend, 0);
+        SDL_SetRenderDrawColor(m_rend, 255, 255, 255, 255);
+        SDL_RenderClear(m_rend);
+        SDL_SetRenderDrawColor(m_rend, 0, 0, 0, 255);
+    }
+
+    // The texture grows in steps so a formula that is being typed doesn't
+    // need a new one for every character
+    bool resize(int w, int h) override
+    {
+        if (m_tex && w <= m_cap_w && h <= m_cap_h)
+        {
+            m_w = w;
+            m_h = h;
+            return true;
+        }
+
+        if (!m_tex)
+        {
+            begin(w, h);
+            return false;
+        }
+
+        // A bigger texture from begin, with what's drawn copied over before
+        // the old one goes back to the pool
+        SDL_Texture *old = m_tex;
+        size_t key = m_key, bytes = (size_t)m_cap_w * m_cap_h * 4;
+        SDL_Rect kept = { 0, 0, m_w, m_h };
+
+        m_tex = nullptr;
+        begin(std::max(w, m_cap_w * 3 / 2), std::max(h, m_cap_h * 3 / 2));
+        SDL_RenderCopy(m_rend, old, &kept, &kept);
+        m_targets.put(key, bytes, old);
+
+        m_w = w;
+        m_h = h;
+        return true;
+    }
+
+    void repaint(const SDL_Rect &r) override
+    {
+        target(m_tex);
+        SDL_RenderSetClipRect(m_rend, &r);
+        SDL_SetRenderDrawColor(m_rend, 255, 255, 255, 255);
+        SDL_RenderFillRect(m_rend, &r);
+        SDL_SetRenderDrawColor(m_rend, 0, 0, 0, 255);
+    }
+
+    void glyph(const Glyph &g, const SDL_Rect &dst) override
+    {
+        SDL_RenderCopy(m_rend, page(g.page), &g.src, &dst);
+    }
+
+    // Rasterized into a black mask on the cpu and drawn as one quad, the
+    // renderer has no anti-aliased fill of its own
+    void path(const path::Path &p) override
+    {
+        SDL_Rect bounds = p.bounds(), canvas = { 0, 0, m_w, m_h }, area;
+        if (!SDL_IntersectRect(&bounds, &canvas, &area))
+            return;
+
+        if (area.w > m_mask_w || area.h > m_mask_h)
+        {
+            if (m_mask) destroy(m_mask);
+            m_mask_w = pool::size_class(std::max(area.w, m_mask_w));
+            m_mask_h = pool::size_class(std::max(area.h, m_mask_h));
+            m_mask = create(SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, m_mask_w, m_mask_h);
+            SDL_SetTextureBlendMode(m_mask, SDL_BLENDMODE_BLEND);
+        }
+
+        path::rasterize(p, area, m_coverage);
+        m_mask_pixels.resize(m_coverage.size());
+        for (size_t i = 0; i < m_coverage.size(); ++i)
+            m_mask_pixels[i] = (Uint32)m_coverage[i] << 24;
+
+        SDL_Rect src = { 0, 0, area.w, area.h };
+        SDL_UpdateTexture(m_mask, &src, m_mask_pixels.data(), area.w * 4);
+        SDL_RenderCopy(m_rend, m_mask, &src, &area);
+    }
+
+    void fill(const SDL_Rect &r) override
+    {
+        SDL_RenderFillRect(m_rend, &r);
+    }
+
+    void line(int x1, int y1, int x2, int y2) override
+    {
+        SDL_RenderDrawLine(m_rend, x1, y1, x2, y2);
+    }
+
+    void present() override
+    {
+        target(nullptr);
+        SDL_SetRenderDrawColor(m_rend, 255, 255, 255, 255);
+        SDL_RenderClear(m_rend);
+
+        SDL_Rect src = { 0, 0, m_w, m_h };
+        SDL_Rect r = { (800 - m_w) / 2, 300 - m_h / 2, m_w, m_h };
+        SDL_RenderCopy(m_rend, m_tex, &src, &r);
+
+        SDL_RenderPresent(m_rend);
+    }
+
+    Image read() override
+    {
+        trace::Scope scope("readback");
+
+        Image img;
+        img.w = m_w;
+        img.h = m_h;
+        img.pixels.resize((size_t)m_w * m_h * 4);
+
+        SDL_Rect src = { 0, 0, m_w, m_h };
+        target(m_tex);
+        SDL_RenderReadPixels(m_rend, &src, SDL_PIXELFORMAT_RGBA32, img.pixels.data(), m_w * 4);
+        return img;
+    }
+
+private:
+    // Textures go through create and destroy, and target switches through
+    // target, so trace sees them
+    SDL_Texture *create(Uint32 format, int access, int w, int h)
+    {
+        trace::count(trace::Counter::TEXTURES);
+        trace::count(trace::Counter::TEXTURE_BYTES, (int64_t)w * h * 4);
+        return SDL_CreateTexture(m_rend, format, access, w, h);
+    }
+
+    void destroy(SDL_Texture *tex)
+    {
+        int w = 0, h = 0;
+        SDL_QueryTexture(tex, nullptr, nullptr, &w, &h);
+        trace::count(trace::Counter::TEXTURE_BYTES, -(int64_t)w * h * 4);
+
+        // SDL goes back to the window when the target is destroyed
+        if (tex == m_target)
+            m_target = nullptr;
+        SDL_DestroyTexture(tex);
+    }
+
+    // Switching to the target that is already set is skipped
+    void target(SDL_Texture *tex)
+    {
+        if (tex == m_target)
+            return;
+
+        trace::count(trace::Counter::TARGET_SWITCHES);
+        SDL_SetRenderTarget(m_rend, tex);
+        m_target = tex;
+    }
+
+    // Uploads an atlas page again if glyphs were added since the last draw
+    SDL_Texture *page(size_t i)
+    {
+        if (i >= m_pages.size())
+            m_pages.resize(i + 1);
+
+        Page &p = m_pages[i];
+        SDL_Surface *surf = g_atlas.page(i);
+
+        if (!p.tex)
+        {
+            p.tex = create(SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                surf->w, surf->h);
+            SDL_SetTextureBlendMode(p.tex, SDL_BLENDMODE_BLEND);
+        }
+
+        if (!p.uploaded || p.version != g_atlas.version(i))
+        {
+            SDL_UpdateTexture(p.tex, 0, surf->pixels, surf->pitch);
+            p.version = g_atlas.version(i);
+            p.uploaded = true;
+        }
+
+        return p.tex;
+    }
+
+private:
+    struct Page
+    {
+        SDL_Texture *tex{ nullptr };
+        unsigned version{ 0 };
+        bool uploaded{ false };
+    };
+
+    SDL_Window *m_win{ nullptr };
+    SDL_Renderer *m_rend{ nullptr };
+
+    SDL_Texture *m_tex{ nullptr };
+    // Current render target, nullptr is the window
+    SDL_Texture *m_target{ nullptr };
+    // Size of the formula and of the texture it's drawn on
+    int m_w{ 0 }, m_h{ 0 };
+    int m_cap_w{ 0 }, m_cap_h{ 0 };
+    // Size class of m_tex in m_targets
+    size_t m_key{ 0 };
+    pool::Pool<SDL_Texture*> m_targets;
+
+    std::vector<Page> m_pages;
+
+    // Streaming texture paths are uploaded to, and its pixels
+    SDL_Texture *m_mask{ nullptr };
+    int m_mask_w{ 0 }, m_mask_h{ 0 };
+    std::vector<Uint8> m_coverage;
+    std::vector<Uint32> m_mask_pixels;
+};
+
+std::unique_ptr<draw::Backend> draw::make_sdl_backend()
+{
+    return std::make_unique<SdlBackend>();
+}
@@ -0,0 +1,211 @@
+#include "backend.h"
+#include "draw.h"
+#include "trace.h"
+#include <cstdio>
+#include <stdexcept>
+
+extern TTF_Font *g_font;
+
+namespace
+{
+    // Shortest decimal that is still exact to a hundredth of a pixel
+    std::string num(float v)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.2f", v);
+
+        std::string s = buf;
+        s.erase(s.find_last_not_of('0') + 1);
+        if (s.back() == '.')
+            s.pop_back();
+
+        return s == "-0" ? "0" : s;
+    }
+
+    void append_utf8(std::string &s, char32_t cp)
+    {
+        switch (cp)
+        {
+        case '&': s += "&amp;"; return;
+        case '<': s += "&lt;"; return;
+        case '>': s += "&gt;"; return;
+        }
+
+        if (cp < 0x80)
+        {
+            s += (char)cp;
+        }
+        else if (cp < 0x800)
+        {
+            s += (char)(0xc0 | cp >> 6);
+            s += (char)(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            s += (char)(0xe0 | cp >> 12);
+            s += (char)(0x80 | (cp >> 6 & 0x3f));
+            s += (char)(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            s += (char)(0xf0 | cp >> 18);
+            s += (char)(0x80 | (cp >> 12 & 0x3f));
+            s += (char)(0x80 | (cp >> 6 & 0x3f));
+            s += (char)(0x80 | (cp & 0x3f));
+        }
+    }
+}
+
+// Glyphs become text in the formula's font at the positions the atlas
+// would have drawn them, measured from the font without rasterizing them.
+// Rules and lines become rects and lines. Nothing is
+// rasterized, so the document stays sharp at any zoom.
+class SvgBackend : public draw::Backend
+{
+public:
+    void begin(int w, int h) override
+    {
+        m_w = w;
+        m_h = h;
+        m_body.clear();
+        m_run = Run();
+    }
+
+    // Nothing drawn can be taken back, the incremental path always starts over
+    void repaint(const SDL_Rect &r) override
+    {
+        flush();
+        m_body += "<rect x=\"" + num(r.x) + "\" y=\"" + num(r.y) + "\" width=\"" + num(r.w) +
+            "\" height=\"" + num(r.h) + "\" fill=\"white\"/>\n";
+    }
+
+    void glyph(const Glyph &g, const SDL_Rect &dst) override
+    {
+        // Whitespace is already in the positions of the glyphs after it
+        if (g.cp <= ' ' || g.src.h <= 0)
+            return;
+
+        float sx = g.src.w ? (float)dst.w / g.src.w : 1.f;
+        float sy = (float)dst.h / g.src.h;
+
+        // dst is the bitmap, text is placed by its pen position and baseline
+        std::shared_ptr<TTF_Font> font = draw::font(g.size);
+        float x = dst.x - g.offset * sx;
+        float y = dst.y + TTF_FontAscent(font ? font.get() : g_font) * sy;
+        text(g.cp, x, y, g.size * sy);
+    }
+
+    // Flattened like the rasterizers draw it, one subpath per outline
+    void path(const path::Path &p) override
+    {
+        if (p.empty())
+            return;
+
+        const std::vector<path::Point> &pts = p.points();
+        const std::vector<size_t> &outlines = p.outlines();
+
+        flush();
+        m_body += "<path d=\"";
+        for (size_t i = 0; i < outlines.size(); ++i)
+        {
+            size_t end = i + 1 < outlines.size() ? outlines[i + 1] : pts.size();
+            for (size_t j = outlines[i]; j < end; ++j)
+                m_body += (j == outlines[i] ? "M" : "L") + num(pts[j].x) + " " + num(pts[j].y);
+            m_body += "Z";
+        }
+        m_body += "\"/>\n";
+    }
+
+    void fill(const SDL_Rect &r) override
+    {
+        flush();
+        m_body += "<rect x=\"" + num(r.x) + "\" y=\"" + num(r.y) + "\" width=\"" + num(r.w) +
+            "\" height=\"" + num(r.h) + "\"/>\n";
+    }
+
+    // Through the pixel centres, the same pixels the rasterizers cover
+    void line(int x1, int y1, int x2, int y2) override
+    {
+        flush();
+        m_body += "<line x1=\"" + num(x1 + .5f) + "\" y1=\"" + num(y1 + .5f) + "\" x2=\"" +
+            num(x2 + .5f) + "\" y2=\"" + num(y2 + .5f) + "\" stroke=\"black\" stroke-linecap=\"square\"/>\n";
+    }
+
+    Image read() override
+    {
+        throw std::runtime_error("The svg backend has no pixels to read");
+    }
+
+    bool vector() const override { return true; }
+
+    bool save(std::vector<Uint8> &out, const encode::Options &) override
+    {
+        trace::Scope scope("encode");
+        flush();
+
+        const char *family = TTF_FontFaceFamilyName(g_font);
+        std::string doc = "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" + num(m_w) +
+            "\" height=\"" + num(m_h) + "\" viewBox=\"0 0 " + num(m_w) + " " + num(m_h) +
+            "\" font-family=\"" + (family ? family : "serif") + "\">\n"
+            "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+
+        out.insert(out.end(), doc.begin(), doc.end());
+        out.insert(out.end(), m_body.begin(), m_body.end());
+
+        const std::string end = "</svg>\n";
+        out.insert(out.end(), end.begin(), end.end());
+
+        m_body.clear();
+        return true;
+    }
+
+    const char *extension() const override { return "svg"; }
+
+private:
+    // Glyphs of one atlas run share a baseline and size, so they go in one
+    // text element with a position for every character
+    void text(char32_t cp, float x, float y, float size)
+    {
+        if (!m_run.text.empty() && (m_run.y != y || m_run.size != size))
+            flush();
+
+        if (m_run.text.empty())
+        {
+            m_run.y = y;
+            m_run.size = size;
+        }
+        else
+        {
+            m_run.xs += ' ';
+        }
+
+        m_run.xs += num(x);
+        append_utf8(m_run.text, cp);
+    }
+
+    void flush()
+    {
+        if (m_run.text.empty())
+            return;
+
+        m_body += "<text x=\"" + m_run.xs + "\" y=\"" + num(m_run.y) + "\" font-size=\"" +
+            num(m_run.size) + "\">" + m_run.text + "</text>\n";
+        m_run = Run();
+    }
+
+private:
+    struct Run
+    {
+        float y{ 0 }, size{ 0 };
+        std::string xs, text;
+    };
+
+    int m_w{ 0 }, m_h{ 0 };
+    std::string m_body;
+    Run m_run;
+};
+
+std::unique_ptr<draw::Backend> draw::make_svg_backend()
+{
+    return std::make_unique<SvgBackend>();
+}
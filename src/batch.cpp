@@ -0,0 +1,345 @@
+#include "batch.h"
+#include "parser.h"
+#include "layout.h"
+#include "draw.h"
+#include "encode.h"
+#include "pipeline.h"
+#include "trace.h"
+#include <map>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+    struct Job
+    {
+        size_t line{ 0 };
+        // Position among the formulas that were read
+        size_t seq{ 0 };
+        std::string formula;
+        std::string out;
+        cache::Key key;
+
+        layout::Layout layout;
+        int w{ 0 }, h{ 0 };
+        Image img;
+        std::vector<Uint8> data;
+    };
+
+    using JobPtr = std::unique_ptr<Job>;
+
+    std::mutex g_log_mutex;
+
+    void report(const Job &job, const std::string &msg)
+    {
+        std::lock_guard<std::mutex> lock(g_log_mutex);
+        std::cerr << "Line " << job.line << ": " << msg << "\n";
+    }
+
+    // Writes every finished formula to one file in input order. Jobs finish
+    // out of order, so early ones wait here until the ones before them are
+    // written or skipped. An svg document is only sized once every formula
+    // is in, so its body is kept until finish.
+    class Stream
+    {
+    public:
+        Stream(const std::string &path, bool svg)
+            : m_out(&std::cout), m_svg(svg)
+        {
+            if (path != "-")
+            {
+                m_file.open(path, std::ios::binary);
+                m_out = &m_file;
+            }
+
+        }
+
+        bool good() const { return m_out->good(); }
+
+        void write(JobPtr job)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t seq = job->seq;
+            m_pending.emplace(seq, std::move(job));
+            drain();
+        }
+
+        // For jobs that failed or won't be written for another reason
+        void skip(size_t seq)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.emplace(seq, nullptr);
+            drain();
+        }
+
+        bool finish()
+        {
+            if (m_svg)
+            {
+                std::string w = std::to_string(m_w),
+                    h = std::to_string(m_y);
+                *m_out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << w << "\" height=\"" << h
+                       << "\" viewBox=\"0 0 " << w << " " << h << "\">\n" << m_body << "</svg>\n";
+            }
+
+            m_out->flush();
+            return m_out->good();
+        }
+
+    private:
+        void drain()
+        {
+            for (auto it = m_pending.begin(); it != m_pending.end() && it->first == m_next;
+                it = m_pending.erase(it), ++m_next)
+            {
+                const JobPtr &job = it->second;
+                if (!job)
+                    continue;
+
+                // Formulas are stacked, each can be referenced by its line
+                if (m_svg)
+                {
+                    m_body += "<g id=\"line-" + std::to_string(job->line) + "\" transform=\"translate(0 " +
+                        std::to_string(m_y) + ")\">\n";
+                    m_body.append((const char*)job->data.data(), job->data.size());
+                    m_body += "</g>\n";
+                }
+                else
+                {
+                    m_out->write((const char*)job->data.data(), job->data.size());
+                }
+
+                m_w = std::max(m_w, job->w);
+                m_y += job->h;
+            }
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::map<size_t, JobPtr> m_pending;
+        size_t m_next{ 0 };
+
+        std::ofstream m_file;
+        std::ostream *m_out;
+        bool m_svg;
+        std::string m_body;
+        int m_w{ 0 }, m_y{ 0 };
+    };
+}
+
+bool batch::run(const Options &opts)
+{
+    std::ifstream ifs(opts.input);
+    if (!ifs)
+    {
+        std::cerr << "Couldn't open '" << opts.input << "'.\n";
+        return false;
+    }
+
+    std::unique_ptr<draw::Backend> probe = draw::make_backend(opts.backend);
+    if (!probe)
+    {
+        std::cerr << "Backend '" << opts.backend << "' does not exist.\n";
+        return false;
+    }
+
+    const char *ext = probe->extension();
+
+    std::unique_ptr<Stream> stream;
+    if (!opts.stream.empty())
+    {
+        stream = std::make_unique<Stream>(opts.stream, probe->vector());
+        if (!stream->good())
+        {
+            std::cerr << "Couldn't open '" << opts.stream << "'.\n";
+            return false;
+        }
+    }
+
+    cache::Cache *cache = stream ? nullptr : opts.cache;
+
+    size_t jobs = opts.jobs;
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    auto begin = std::chrono::steady_clock::now();
+    std::atomic<size_t> done{ 0 }, failed{ 0 }, cached{ 0 }, shared{ 0 };
+    // Set once the stream can't be written anymore, no more lines are read
+    std::atomic<bool> broken{ false };
+
+    // Errors are reported and counted, the formula is left out and the
+    // pipeline carries on with the next one
+    auto fail = [&](const Job &job, const std::string &msg) {
+        report(job, msg);
+        ++failed;
+        if (stream)
+            stream->skip(job.seq);
+    };
+
+    pipeline::Queue<JobPtr> lines(opts.queue_size),
+        laid_out(opts.queue_size),
+        rastered(opts.queue_size);
+
+    pipeline::Stage parse_stage(jobs, [&] {
+        JobPtr job;
+        while (lines.pop(job))
+        {
+            try
+            {
+                Parser p(job->formula);
+                Ast ast = p.parse();
+
+                if (cache)
+                {
+                    job->key = cache->key(ast);
+                    if (cache->fetch(job->key, job->out))
+                    {
+                        ++done;
+                        ++cached;
+                        continue;
+                    }
+                }
+
+                job->layout.build(ast);
+                shared += job->layout.shared_hits();
+            }
+            catch (const std::exception &e)
+            {
+                fail(*job, e.what());
+                continue;
+            }
+
+            laid_out.push(std::move(job));
+        }
+    }, [&] { laid_out.close(); });
+
+    pipeline::Stage raster_stage(jobs, [&] {
+        std::unique_ptr<draw::Backend> be = draw::make_backend(opts.backend);
+
+        JobPtr job;
+        while (laid_out.pop(job))
+        {
+            try
+            {
+                const layout::Box &b = job->layout.box(job->layout.root());
+                {
+                    trace::Scope scope("raster");
+                    be->begin(b.w, b.h);
+                    draw::raster(*be, job->layout, job->layout.root(), { 0, 0, b.w, b.h });
+                }
+                job->w = b.w;
+                job->h = b.h;
+
+                // Vector documents are finished as they are drawn
+                if (be->vector())
+                    be->save(job->data);
+                else
+                    job->img = be->read();
+            }
+            catch (const std::exception &e)
+            {
+                fail(*job, e.what());
+                continue;
+            }
+
+            rastered.push(std::move(job));
+        }
+    }, [&] { rastered.close(); });
+
+    pipeline::Stage encode_stage(jobs, [&] {
+        JobPtr job;
+        while (rastered.pop(job))
+        {
+            bool encoded;
+            try
+            {
+                encoded = !job->data.empty() || encode::save(job->img, job->data);
+            }
+            catch (const std::exception &e)
+            {
+                fail(*job, e.what());
+                continue;
+            }
+
+            if (!encoded)
+            {
+                fail(*job, "couldn't encode the image");
+                continue;
+            }
+
+            job->img = Image();
+            if (stream)
+            {
+                stream->write(std::move(job));
+                ++done;
+                if (!stream->good())
+                    broken = true;
+            }
+            else if (encode::write(job->data, job->out))
+            {
+                if (cache)
+                    cache->store(job->key, job->data);
+                ++done;
+            }
+            else
+            {
+                report(*job, "couldn't write '" + job->out + "'");
+                ++failed;
+            }
+        }
+    }, [] {});
+
+    std::string buf;
+    size_t line = 0,
+        seq = 0;
+    while (!broken && std::getline(ifs, buf))
+    {
+        ++line;
+        if (buf.empty())
+            continue;
+
+        JobPtr job = std::make_unique<Job>();
+        job->layout = layout::Layout(probe->vector());
+        job->line = line;
+        job->seq = seq++;
+
+        size_t tab = buf.find('\t');
+        if (tab == std::string::npos)
+        {
+            job->formula = buf + '\n';
+            job->out = opts.out_dir + "/" + std::to_string(line) + "." + ext;
+        }
+        else
+        {
+            job->formula = buf.substr(0, tab) + '\n';
+            job->out = buf.substr(tab + 1);
+        }
+
+        lines.push(std::move(job));
+    }
+
+    lines.close();
+    parse_stage.join();
+    raster_stage.join();
+    encode_stage.join();
+
+    if (stream && !stream->finish())
+    {
+        std::cerr << "Couldn't write '" << opts.stream << "'.\n";
+        ++failed;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    std::cerr << "Rendered " << done << " formulas in " << elapsed.count() << "s ("
+              << done / std::max(elapsed.count(), 1e-9) << " formulas/s), "
+              << failed << " failed";
+    if (cache)
+        std::cerr << ", " << cached << " from cache (" << cache->hits() << " hits, "
+                  << cache->misses() << " misses)";
+    std::cerr << ", " << shared << " repeated subtrees reused.\n";
+
+    return failed == 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "cache.h"
+#include <string>
+
+namespace batch
+{
+    struct Options
+    {
+        // One formula per line, or "formula<TAB>output path" per line
+        std::string input;
+        // Where formulas without an output path go, named after their line
+        std::string out_dir{ "." };
+        // Writes every formula to this one file in input order instead, "-"
+        // for stdout. Images are concatenated, svg formulas are stacked in
+        // one document. Output paths in the input are ignored.
+        std::string stream;
+        // "cpu" or "svg"
+        std::string backend{ "cpu" };
+
+        // Threads per stage, 0 picks the number of hardware threads
+        size_t jobs{ 0 };
+        // Formulas in flight between two stages
+        size_t queue_size{ 64 };
+
+        // Formulas found here skip layout and drawing, optional. Not used
+        // when streaming.
+        cache::Cache *cache{ nullptr };
+    };
+
+    // Parses, lays out, rasterizes and encodes every formula of the input
+    // on a pipeline of worker threads. Formulas that fail are reported and
+    // skipped. Returns false if any failed, or if the input, backend or
+    // stream couldn't be opened.
+    bool run(const Options &opts);
+}
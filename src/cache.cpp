@@ -0,0 +1,178 @@
+#include "cache.h"
+#include "hash.h"
+#include "commands.h"
+#include "encode.h"
+#include "resources.h"
+#include <thread>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+extern int g_font_size;
+
+// Bump whenever layout or drawing changes what a formula looks like
+static const Uint64 g_format_version = 3;
+
+cache::Cache::Cache(const Options &opts, const std::string &backend)
+    : m_opts(opts),
+    m_backend(backend),
+    m_ext(backend == "svg" ? "svg" : encode::extension(encode::g_options.format))
+{
+    std::error_code ec;
+    fs::create_directories(m_opts.dir, ec);
+
+    refresh();
+}
+
+void cache::Cache::refresh()
+{
+    Uint64 params = hash::combine(hash::g_offset, g_format_version);
+    params = hash::string(m_backend, params);
+    params = hash::string(m_ext, params);
+    params = hash::combine(params, g_font_size);
+    params = hash::combine(params, commands::fingerprint());
+    params = hash::combine(params, encode::fingerprint());
+    // A replaced font invalidates everything rendered with the old one
+    params = hash::combine(params, resources::fingerprint());
+    m_params = params;
+}
+
+cache::Key cache::Cache::key(const Ast &ast) const
+{
+    Uint64 params = m_params;
+    Key key;
+    key.name = hash::hex(hash::combine(params, hash::node(ast, ast.root())));
+    key.source = hash::hex(params) + hash::canonical(ast, ast.root());
+    return key;
+}
+
+// Entries are the length of the key's source on a line of its own, the
+// source, then the output
+bool cache::Cache::fetch(const Key &key, const std::string &out)
+{
+    std::vector<Uint8> data;
+    return fetch(key, data) && encode::write(data, out);
+}
+
+bool cache::Cache::fetch(const Key &key, std::vector<Uint8> &data)
+{
+    std::ifstream ifs(entry(key), std::ios::binary);
+    size_t n = 0;
+    std::string source;
+    if (ifs >> n && ifs.get() == '\n' && n == key.source.size())
+    {
+        source.resize(n);
+        ifs.read(source.data(), n);
+    }
+
+    if (!ifs || source != key.source)
+    {
+        ++m_misses;
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+    // Eviction is least recently used first
+    std::error_code ec;
+    fs::last_write_time(entry(key), fs::file_time_type::clock::now(), ec);
+    ++m_hits;
+    return true;
+}
+
+void cache::Cache::store(const Key &key, const std::string &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        return;
+
+    store(key, std::vector<Uint8>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()));
+}
+
+void cache::Cache::store(const Key &key, const std::vector<Uint8> &data)
+{
+    // Written to a temporary file and renamed so other processes never see
+    // half an entry
+    fs::path tmp = temp(key);
+    {
+        std::ofstream ofs(tmp, std::ios::binary);
+        ofs << key.source.size() << '\n' << key.source;
+        ofs.write((const char*)data.data(), data.size());
+        if (!ofs)
+        {
+            ofs.close();
+            std::error_code ec;
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmp, entry(key), ec);
+}
+
+void cache::Cache::evict()
+{
+    struct Entry
+    {
+        fs::path path;
+        Uint64 size;
+        fs::file_time_type time;
+    };
+
+    std::vector<Entry> entries;
+    Uint64 total = 0;
+    auto now = fs::file_time_type::clock::now();
+    auto oldest = now - std::chrono::hours(24 * m_opts.max_age_days);
+    // Stores finish in far less, older ones were cut short
+    auto stale = now - std::chrono::hours(1);
+
+    std::error_code ec;
+    for (const auto &e : fs::directory_iterator(m_opts.dir, ec))
+    {
+        if (!e.is_regular_file(ec))
+            continue;
+
+        Entry entry = { e.path(), e.file_size(ec), e.last_write_time(ec) };
+        if (e.path().extension() == ".tmp")
+        {
+            if (entry.time < stale)
+                fs::remove(entry.path, ec);
+            continue;
+        }
+
+        if (entry.time < oldest)
+        {
+            fs::remove(entry.path, ec);
+            continue;
+        }
+
+        total += entry.size;
+        entries.emplace_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.time < b.time;
+    });
+
+    for (size_t i = 0; i < entries.size() && total > m_opts.max_bytes; ++i)
+    {
+        fs::remove(entries[i].path, ec);
+        total -= entries[i].size;
+    }
+}
+
+fs::path cache::Cache::entry(const Key &key) const
+{
+    return fs::path(m_opts.dir) / (key.name + "." + m_ext);
+}
+
+fs::path cache::Cache::temp(const Key &key) const
+{
+    std::string id = std::to_string(getpid()) + "-" +
+        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return fs::path(m_opts.dir) / (key.name + "." + id + ".tmp");
+}
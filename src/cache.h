@@ -0,0 +1,72 @@
+#pragma once
+#include "node.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <SDL2/SDL.h>
+
+namespace cache
+{
+    struct Options
+    {
+        std::string dir;
+
+        Uint64 max_bytes{ 512ull << 20 };
+        // Entries that haven't been used for this long are dropped
+        int max_age_days{ 30 };
+    };
+
+    struct Key
+    {
+        // File name of the entry, without the extension
+        std::string name;
+        // Everything the entry was made from, checked on every hit so a hash
+        // collision is a miss instead of another formula's output
+        std::string source;
+    };
+
+    // Content addressed store of rendered images. Entries are keyed by the
+    // structural hash of the formula together with everything else that
+    // changes the output, so unchanged formulas skip layout and drawing.
+    // Safe to share between threads and processes.
+    class Cache
+    {
+    public:
+        Cache(const Options &opts, const std::string &backend);
+
+        Key key(const Ast &ast) const;
+        // Takes in a reloaded font, formulas drawn with the old one become
+        // misses
+        void refresh();
+
+        // Copies the entry for key to out, false on a miss
+        bool fetch(const Key &key, const std::string &out);
+        bool fetch(const Key &key, std::vector<Uint8> &data);
+
+        void store(const Key &key, const std::string &path);
+        void store(const Key &key, const std::vector<Uint8> &data);
+
+        // Drops entries that are too old, then the least recently used ones
+        // until everything fits in max_bytes. Temporary files left behind by
+        // stores that never finished are dropped after an hour.
+        void evict();
+
+        size_t hits() const { return m_hits; }
+        size_t misses() const { return m_misses; }
+
+    private:
+        std::filesystem::path entry(const Key &key) const;
+        std::filesystem::path temp(const Key &key) const;
+
+    private:
+        Options m_opts;
+        std::string m_backend;
+        // Hash of everything but the formula that changes the output
+        std::atomic<Uint64> m_params{ 0 };
+        // Of what the backend and encoder write, entries are named after it
+        std::string m_ext;
+
+        std::atomic<size_t> m_hits{ 0 }, m_misses{ 0 };
+    };
+}
@@ -0,0 +1,358 @@
+#include "commands.h"
+#include "layout.h"
+#include "hash.h"
+#include <array>
+#include <deque>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+    using commands::Command;
+    namespace fns = layout::functions;
+
+    constexpr Command g_builtins[] = {
+        { "frac", 2, fns::frac },
+        { "sum", 2, fns::sum },
+        { "int", 0, fns::integral },
+        { "oint", 0, fns::ointegral },
+        { "lim", 1, fns::lim },
+        { "vec", 1, fns::vec },
+        { "sqrt", 1, fns::sqrt },
+        { "paren", 1, fns::paren },
+        { "bracket", 1, fns::bracket },
+
+        { "^", 2, fns::exponent },
+        { "_", 2, fns::subscript },
+
+        { "pi", 0, nullptr, U'π' },
+        { "theta", 0, nullptr, U'θ' },
+        { "phi", 0, nullptr, U'ϕ' },
+        { "inf", 0, nullptr, U'∞' },
+        { "to", 0, nullptr, U'→' },
+        { "delta", 0, nullptr, U'Δ' },
+        { "epsilon", 0, nullptr, U'ε' },
+        { "omega", 0, nullptr, U'ω' },
+        { "lambda", 0, nullptr, U'λ' },
+        { "mu", 0, nullptr, U'μ' },
+        { "plusminus", 0, nullptr, U'±' },
+        { "cross", 0, nullptr, U'×' },
+        { "dot", 0, nullptr, U'∙' },
+        { "le", 0, nullptr, U'≤' },
+        { "ge", 0, nullptr, U'≥' },
+        { "ell", 0, nullptr, U'ℓ' },
+        { "alpha", 0, nullptr, U'α' },
+        { "beta", 0, nullptr, U'β' },
+        { "gamma", 0, nullptr, U'γ' },
+        { "Phi", 0, nullptr, U'Φ' },
+        { "Omega", 0, nullptr, U'Ω' },
+        { "rho", 0, nullptr, U'ρ' },
+        { "sigma", 0, nullptr, U'σ' },
+        { "tau", 0, nullptr, U'τ' }
+    };
+
+    constexpr size_t g_builtin_count = std::size(g_builtins);
+
+    // Seeded FNV-1a with a murmur finalizer so nearby seeds spread well
+    constexpr Uint32 hash_name(Uint32 seed, std::string_view s)
+    {
+        Uint32 h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (char c : s)
+        {
+            h ^= (unsigned char)c;
+            h *= 16777619u;
+        }
+
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    constexpr size_t pow2_at_least(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p *= 2;
+
+        return p;
+    }
+
+    // Hash and displace: names are put into buckets by one hash, and every
+    // bucket gets its own seed that sends all of its names to free slots.
+    // A lookup is then two hashes and a single comparison, never a probe.
+    const Uint32 g_max_displacement = 1 << 16;
+
+    constexpr size_t bucket_of(std::string_view name, size_t nbuckets)
+    {
+        return hash_name(0, name) & (nbuckets - 1);
+    }
+
+    // Tries to place every name in bucket with seed d, leaves slots as they
+    // were on failure
+    template <typename Slots>
+    constexpr bool displace(const Command *cmds, size_t n, size_t bucket, size_t nbuckets,
+        Uint32 d, Slots &slots)
+    {
+        size_t mask = slots.size() - 1;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (bucket_of(cmds[i].name, nbuckets) != bucket)
+                continue;
+
+            auto &slot = slots[hash_name(d, cmds[i].name) & mask];
+            if (slot == -1)
+            {
+                slot = i;
+                continue;
+            }
+
+            for (size_t j = 0; j < i; ++j)
+            {
+                if (bucket_of(cmds[j].name, nbuckets) == bucket)
+                    slots[hash_name(d, cmds[j].name) & mask] = -1;
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+
+    // slots and displacements need power of two sizes. Fails if some bucket
+    // can't be placed, a bigger slots array helps then.
+    template <typename Slots, typename Disp>
+    constexpr bool build(const Command *cmds, size_t n, Slots &slots, Disp &disp)
+    {
+        for (auto &s : slots)
+            s = -1;
+
+        size_t nbuckets = disp.size(),
+            largest = 0;
+
+        for (size_t b = 0; b < nbuckets; ++b)
+        {
+            disp[b] = 0;
+            for (size_t i = 0; i < n; ++i)
+                disp[b] += bucket_of(cmds[i].name, nbuckets) == b;
+
+            if (disp[b] > largest)
+                largest = disp[b];
+        }
+
+        // Biggest buckets first while there is the most room. disp holds the
+        // bucket sizes until a bucket is placed, placed ones are marked so a
+        // seed isn't mistaken for a size.
+        const Uint32 placed = 1u << 31;
+        for (size_t size = largest; size > 0; --size)
+        {
+            for (size_t b = 0; b < nbuckets; ++b)
+            {
+                if (disp[b] != size)
+                    continue;
+
+                Uint32 d = 1;
+                while (!displace(cmds, n, b, nbuckets, d, slots))
+                {
+                    if (++d == g_max_displacement)
+                        return false;
+                }
+
+                disp[b] = d | placed;
+            }
+        }
+
+        for (auto &d : disp)
+            d &= ~placed;
+
+        return true;
+    }
+}
+
+namespace
+{
+    constexpr size_t g_builtin_slots = pow2_at_least(g_builtin_count * 2);
+    constexpr size_t g_builtin_buckets = pow2_at_least(g_builtin_count / 2);
+
+    struct BuiltinTable
+    {
+        std::array<int, g_builtin_slots> slots{};
+        std::array<Uint32, g_builtin_buckets> disp{};
+        bool ok{ false };
+    };
+
+    constexpr BuiltinTable make_builtin_table()
+    {
+        BuiltinTable t;
+        t.ok = build(g_builtins, g_builtin_count, t.slots, t.disp);
+        return t;
+    }
+
+    constexpr BuiltinTable g_builtin_table = make_builtin_table();
+    static_assert(g_builtin_table.ok, "No perfect hash for the built in commands");
+
+    // Table find looks in, the built in one until load merges in symbols
+    struct Table
+    {
+        const Command *cmds;
+        const int *slots;
+        size_t slot_mask;
+        const Uint32 *disp;
+        size_t disp_mask;
+    };
+
+    Table g_table = {
+        g_builtins,
+        g_builtin_table.slots.data(), g_builtin_slots - 1,
+        g_builtin_table.disp.data(), g_builtin_buckets - 1
+    };
+
+    // Backing storage for g_table once symbols are loaded
+    std::vector<Command> g_commands;
+    std::vector<int> g_slots;
+    std::vector<Uint32> g_disp;
+    std::deque<std::string> g_names;
+
+    Uint64 g_fingerprint = 0;
+
+    // Decodes s if it is exactly one UTF-8 encoded codepoint
+    bool decode_utf8(const std::string &s, char32_t &cp)
+    {
+        if (s.empty())
+            return false;
+
+        unsigned char c = s[0];
+        size_t len = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 0;
+        if (!len || s.size() != len)
+            return false;
+
+        cp = len == 1 ? c : c & (0x7f >> len);
+        for (size_t i = 1; i < len; ++i)
+        {
+            if (((unsigned char)s[i] >> 6) != 2)
+                return false;
+
+            cp = cp << 6 | (s[i] & 0x3f);
+        }
+
+        return true;
+    }
+
+    bool parse_codepoint(const std::string &s, char32_t &cp)
+    {
+        if (s.size() > 2 && (s[0] == 'U' || s[0] == 'u') && s[1] == '+')
+        {
+            size_t end = 0;
+            try
+            {
+                cp = std::stoul(s.substr(2), &end, 16);
+            }
+            catch (const std::exception &)
+            {
+                return false;
+            }
+
+            return end == s.size() - 2 && cp <= 0x10ffff;
+        }
+
+        return decode_utf8(s, cp);
+    }
+}
+
+const Command *commands::find(std::string_view name)
+{
+    Uint32 d = g_table.disp[hash_name(0, name) & g_table.disp_mask];
+    int i = g_table.slots[hash_name(d, name) & g_table.slot_mask];
+    return i >= 0 && g_table.cmds[i].name == name ? &g_table.cmds[i] : nullptr;
+}
+
+bool commands::load(const std::string &path)
+{
+    std::ifstream ifs(path);
+    if (!ifs)
+    {
+        std::cerr << "Couldn't open symbol file '" << path << "'.\n";
+        return false;
+    }
+
+    // Nothing changes unless the whole file is valid
+    std::vector<Command> cmds = g_commands;
+    if (cmds.empty())
+        cmds.assign(std::begin(g_builtins), std::end(g_builtins));
+    Uint64 fingerprint = g_fingerprint;
+
+    std::string line;
+    for (size_t lineno = 1; std::getline(ifs, line); ++lineno)
+    {
+        std::istringstream ss(line);
+        std::string name, value, rest;
+        if (!(ss >> name) || name[0] == '#')
+            continue;
+
+        auto error = [&](const std::string &msg) {
+            std::cerr << "'" << path << "' line " << lineno << ": " << msg << "\n";
+            return false;
+        };
+
+        // The lexer only reads letters after a backslash
+        for (char c : name)
+        {
+            if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z'))
+                return error("symbol name '" + name + "' may only contain letters");
+        }
+
+        char32_t cp;
+        if (!(ss >> value) || !parse_codepoint(value, cp) || ss >> rest)
+            return error("expected a name followed by U+XXXX or a single character");
+
+        auto it = std::find_if(cmds.begin(), cmds.end(),
+            [&](const Command &c) { return c.name == name; });
+
+        if (it == cmds.end())
+        {
+            g_names.emplace_back(name);
+            cmds.push_back({ g_names.back(), 0, nullptr, cp });
+        }
+        else if (it->layout)
+            return error("'" + name + "' is a built in function and can't be redefined");
+        else
+            it->codepoint = cp;
+
+        fingerprint = hash::combine(hash::string(name, fingerprint), cp);
+    }
+
+    g_commands = std::move(cmds);
+    g_fingerprint = fingerprint;
+
+    // Grow the table until every bucket fits, the first try nearly always does
+    size_t slots = pow2_at_least(g_commands.size() * 2);
+    g_disp.assign(pow2_at_least(g_commands.size() / 2), 0);
+    while (true)
+    {
+        g_slots.assign(slots, -1);
+        if (build(g_commands.data(), g_commands.size(), g_slots, g_disp))
+            break;
+
+        slots *= 2;
+    }
+
+    g_table = {
+        g_commands.data(),
+        g_slots.data(), g_slots.size() - 1,
+        g_disp.data(), g_disp.size() - 1
+    };
+
+    return true;
+}
+
+Uint64 commands::fingerprint()
+{
+    return g_fingerprint;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "node.h"
+#include <string>
+#include <string_view>
+#include <SDL2/SDL.h>
+
+namespace layout
+{
+    class Layout;
+    struct Item;
+}
+
+// Everything known about each \command: how many arguments the parser reads
+// for it and how it is laid out. Built in commands are hashed perfectly at
+// compile time, symbols from a config file are merged in at startup and
+// looked up the same way.
+namespace commands
+{
+    using LayoutFn = layout::Item (*)(layout::Layout &l, const Node &fn);
+
+    struct Command
+    {
+        std::string_view name;
+        size_t arity{ 0 };
+
+        // Lays out the command and its arguments, nullptr for plain symbols
+        LayoutFn layout{ nullptr };
+        // Drawn from the font if there is no layout function
+        char32_t codepoint{ 0 };
+    };
+
+    // Returns nullptr if there is no command called name
+    const Command *find(std::string_view name);
+
+    // Adds symbols from path, one "name codepoint" pair per line where the
+    // codepoint is either U+XXXX or the character itself in UTF-8. Blank
+    // lines and lines starting with # are skipped. Built in functions can't
+    // be redefined. Call before any parsing starts.
+    bool load(const std::string &path);
+
+    // Changes whenever load adds or redefines a symbol, part of cache keys
+    Uint64 fingerprint();
+}
@@ -1,427 +1,708 @@
 #include "draw.h"
+#include "atlas.h"
+#include "resources.h"
+#include "encode.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "pool.h"
+#include <cmath>
+#include <mutex>
+#include <tuple>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
 #include <stdexcept>
 #include <iostream>
-#include <unordered_map>
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 
-SDL_Window *g_win{ nullptr };
-SDL_Renderer *g_rend{ nullptr };
+std::unique_ptr<draw::Backend> g_backend;
 
 TTF_Font *g_font{ nullptr };
+int g_font_size{ 64 };
+Atlas g_atlas;
 
-void draw::init()
+// g_font at other sizes glyphs were drawn at recently. Past g_max_fonts
+// the least recently used one is dropped, and closed once nobody holds it.
+struct SizedFont
 {
-    SDL_Init(SDL_INIT_VIDEO);
-    IMG_Init(IMG_INIT_PNG);
-    TTF_Init();
-    g_win = SDL_CreateWindow("Acrylic",
-        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-        800, 600,
-#ifdef __EMSCRIPTEN__
-        SDL_WINDOW_SHOWN
-#else
-        SDL_WINDOW_HIDDEN
-#endif
-    );
-    g_rend = SDL_CreateRenderer(g_win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    g_font = TTF_OpenFont("res/font.ttf", 64);
-
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderClear(g_rend);
-}
-
-void draw::quit()
+    std::shared_ptr<TTF_Font> font;
+    Uint64 used{ 0 };
+};
+static std::unordered_map<int, SizedFont> g_fonts;
+static Uint64 g_fonts_clock{ 0 };
+static std::mutex g_fonts_mutex;
+static const size_t g_max_fonts = 16;
+// Callers of open that haven't closed yet, the font is open while there are any
+static size_t g_users{ 0 };
+static std::mutex g_open_mutex;
+
+size_t g_threads{ 1 };
+size_t pool::g_budget{ 0 };
+// Below this many glyphs and strokes a formula isn't worth splitting up
+static const size_t g_parallel_cost = 512;
+// Taller formulas are saved a band of this many rows at a time
+static const int g_band_rows = 1024;
+
+namespace
 {
-    SDL_DestroyRenderer(g_rend);
-    SDL_DestroyWindow(g_win);
-    TTF_Quit();
-    IMG_Quit();
-    SDL_Quit();
-}
-
-static void save_texture(const char* file_name, SDL_Renderer* renderer, SDL_Texture* texture) {
-    SDL_Texture* target = SDL_GetRenderTarget(renderer);
-    SDL_SetRenderTarget(renderer, texture);
-    int width, height;
-    SDL_QueryTexture(texture, NULL, NULL, &width, &height);
-    SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 32, 0, 0, 0, 0);
-    SDL_RenderReadPixels(renderer, NULL, surface->format->format, surface->pixels, surface->pitch);
-    IMG_SavePNG(surface, file_name);
-    SDL_FreeSurface(surface);
-    SDL_SetRenderTarget(renderer, target);
-}
+    // What draw::draw drew last, so the next formula can be drawn on top of it
+    struct Live
+    {
+        layout::Layout layout;
+        layout::BoxId root{ 0 };
+        int w{ 0 }, h{ 0 };
+        bool drawn{ false };
+        // Part of the canvas the last draw painted
+        SDL_Rect damage{ 0, 0, 0, 0 };
+
+        void reset()
+        {
+            layout = layout::Layout(g_backend && g_backend->vector());
+            drawn = false;
+        }
+    };
 
-void draw::draw(const Node *root, bool ask_filename)
-{
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderClear(g_rend);
+    Live g_live;
 
-    Drawing d = compound(root);
+    // A box placed somewhere on the canvas
+    struct Piece
+    {
+        layout::BoxId box;
+        SDL_Rect dst;
+
+        bool operator<(const Piece &o) const
+        {
+            return std::tie(box, dst.x, dst.y, dst.w, dst.h) <
+                std::tie(o.box, o.dst.x, o.dst.y, o.dst.w, o.dst.h);
+        }
+
+        bool operator==(const Piece &o) const
+        {
+            return !(*this < o) && !(o < *this);
+        }
+    };
 
-    SDL_SetRenderTarget(g_rend, 0);
+    void collect(const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+        const std::function<bool(layout::BoxId)> &stop, std::vector<Piece> &out);
 
-#ifdef __EMSCRIPTEN__
-    SDL_RenderClear(g_rend);
+    void close_fonts()
+    {
+        std::lock_guard<std::mutex> lock(g_fonts_mutex);
+        g_fonts.clear();
+    }
 
-    SDL_Rect r = { (800 - d.w) / 2, 300 - d.h / 2, d.w, d.h };
-    SDL_RenderCopy(g_rend, d.tex, 0, &r);
+    SDL_Rect bounds(SDL_Rect r);
+    SDL_Rect spill(const SDL_Rect &dst);
 
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderPresent(g_rend);
+#ifndef __EMSCRIPTEN__
+    bool save_bands(draw::Backend &be, const layout::Layout &l, layout::BoxId id,
+        const std::string &path);
 #endif
+}
 
-#ifndef __EMSCRIPTEN__
-    std::string out = "out.png";
-    if (ask_filename)
+void draw::init(const std::string &backend, size_t threads)
+{
+    trace::Scope scope("init");
+    g_threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+    try
+    {
+        open();
+    }
+    catch (const std::runtime_error &e)
     {
-        std::cout << "Save file as [default: out.png]: ";
-        std::getline(std::cin, out);
+        std::cerr << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
 
-        if (out.empty())
-            out = "out.png";
+    g_backend = make_backend(backend);
+    if (!g_backend)
+    {
+        std::cerr << "Backend '" << backend << "' does not exist.\n";
+        exit(EXIT_FAILURE);
     }
+    g_live.reset();
+}
 
-    save_texture(out.c_str(), g_rend, d.tex);
-#endif
-    SDL_DestroyTexture(d.tex);
+void draw::quit()
+{
+    g_live.reset();
+    g_backend.reset();
+    close();
 }
 
-Drawing draw::draw_expr(const Node *expr)
+void draw::open()
 {
-    switch (expr->type)
+    std::lock_guard<std::mutex> lock(g_open_mutex);
+    if (g_users++)
+        return;
+
+    TTF_Init();
+    g_font = resources::font(g_font_size);
+    if (!g_font)
     {
-    case NodeType::FN: return fn(expr);
-    case NodeType::ID: return text(expr->id);
-    case NodeType::COMPOUND: return compound(expr);
-    case NodeType::NOOP: return text(" ");
-    default: throw std::runtime_error("error in draw::draw_expr");
+        std::string err = TTF_GetError();
+        TTF_Quit();
+        g_users = 0;
+        throw std::runtime_error("Could not open the font: " + err);
     }
 }
 
-Drawing draw::compound(const Node *cpd)
+void draw::close()
 {
-    std::vector<Drawing> drawings;
-    for (const auto &e : cpd->comp_values)
-        drawings.emplace_back(draw_expr(e.get()));
-
-    int w = 0,
-        h = 0;
+    std::lock_guard<std::mutex> lock(g_open_mutex);
+    if (!g_users || --g_users)
+        return;
+
+    g_atlas.clear();
+    close_fonts();
+    TTF_CloseFont(g_font);
+    g_font = nullptr;
+    resources::free();
+    TTF_Quit();
+}
 
-    for (const auto &d : drawings)
+bool draw::reload()
+{
+    std::lock_guard<std::mutex> lock(g_open_mutex);
+    if (!g_users)
+        return false;
+
+    // Opened before anything is dropped, so a font that went missing leaves
+    // the old one in use
+    TTF_Font *font = resources::reload_font(g_font_size);
+    if (!font)
     {
-        if (d.h > h)
-            h = d.h;
-
-        w += d.w + 10;
+        std::cerr << "Couldn't reload the font, keeping the old one: " << TTF_GetError() << "\n";
+        return false;
     }
 
-    w -= 10;
+    g_live.reset();
+    g_atlas.clear();
 
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
+    close_fonts();
+    TTF_CloseFont(g_font);
+    g_font = font;
+    resources::release_old();
+    return true;
+}
+
+std::unique_ptr<draw::Backend> draw::make_backend(const std::string &name)
+{
+    if (name == "sdl") return make_sdl_backend();
+    if (name == "cpu") return make_cpu_backend();
+    if (name == "svg") return make_svg_backend();
+    return nullptr;
+}
 
-    int x = 0;
-    for (auto &d : drawings)
+void draw::draw(const Ast &ast, const std::string &out)
+{
+    layout::Layout &l = g_live.layout;
+    layout::BoxId root = l.update(ast);
+    const layout::Box &b = l.box(root);
+
+#ifndef __EMSCRIPTEN__
+    // Tall documents never get a canvas or texture of their full height
+    if (!g_backend->vector() && b.h > g_band_rows)
     {
-        SDL_Rect r = { x, h / 2 - d.h / 2, d.w, d.h };
-        SDL_RenderCopy(g_rend, d.tex, 0, &r);
-        x += d.w + 10;
+        if (!save_bands(*g_backend, l, root, out))
+            std::cerr << "Failed to save '" << out << "'.\n";
 
-        SDL_DestroyTexture(d.tex);
+        // Only the last band is left on the canvas
+        g_live.drawn = false;
+        g_live.damage = { 0, 0, b.w, b.h };
+        return;
     }
+#endif
 
-    return { tex, w, h };
-}
+    bool kept = g_live.drawn && l.first_new() > 0 && g_backend->resize(b.w, b.h);
+    if (!kept)
+    {
+        g_backend->begin(b.w, b.h);
+        raster_parallel(*g_backend, l, root, { 0, 0, b.w, b.h }, g_threads);
+        g_live.damage = { 0, 0, b.w, b.h };
+    }
+    else
+    {
+        trace::Scope scope("raster incremental");
+
+        // Everything placed by the new formula down to the boxes it reused,
+        // and everything the old one placed down to those same boxes. Any
+        // piece that isn't in both changed.
+        std::vector<Piece> now, before;
+        std::unordered_set<layout::BoxId> reused;
+
+        collect(l, root, { 0, 0, b.w, b.h }, [&](layout::BoxId id) {
+            if (id >= l.first_new())
+                return false;
+
+            reused.insert(id);
+            return true;
+        }, now);
+
+        collect(l, g_live.root, { 0, 0, g_live.w, g_live.h }, [&](layout::BoxId id) {
+            return reused.count(id) > 0;
+        }, before);
+
+        std::sort(now.begin(), now.end());
+        std::sort(before.begin(), before.end());
+
+        std::vector<Piece> changed;
+        std::set_symmetric_difference(now.begin(), now.end(), before.begin(), before.end(),
+            std::back_inserter(changed));
+
+        SDL_Rect damage = { 0, 0, 0, 0 };
+        auto add = [&](const SDL_Rect &r) {
+            if (SDL_RectEmpty(&damage))
+                damage = r;
+            else
+                SDL_UnionRect(&damage, &r, &damage);
+        };
+
+        for (const auto &p : changed)
+            add(spill(p.dst));
+
+        // Parts of the canvas the old formula didn't cover hold leftovers
+        if (b.w > g_live.w)
+            add({ g_live.w, 0, b.w - g_live.w, b.h });
+        if (b.h > g_live.h)
+            add({ 0, g_live.h, b.w, b.h - g_live.h });
+
+        SDL_Rect canvas = { 0, 0, b.w, b.h };
+        if (!SDL_IntersectRect(&damage, &canvas, &damage))
+            damage = { 0, 0, 0, 0 };
+
+        if (!SDL_RectEmpty(&damage))
+        {
+            g_backend->repaint(damage);
+            raster(*g_backend, l, root, { 0, 0, b.w, b.h }, &damage);
+        }
+
+        g_live.damage = damage;
+    }
 
-Drawing draw::fn(const Node *fn)
-{
-    if (fn->fn_name == "frac") return functions::frac(fn);
-    if (fn->fn_name == "sum") return functions::sum(fn);
-    if (fn->fn_name == "int") return functions::integral(fn);
-    if (fn->fn_name == "oint") return functions::ointegral(fn);
-    if (fn->fn_name == "lim") return functions::lim(fn);
-    if (fn->fn_name == "vec") return functions::vec(fn);
-    if (fn->fn_name == "sqrt") return functions::sqrt(fn);
-
-    if (fn->fn_name == "^") return functions::exponent(fn);
-    if (fn->fn_name == "_") return functions::subscript(fn);
-
-    std::unordered_map<std::string, std::wstring> unicode_chars = {
-        { "pi", L"π" },
-        { "theta", L"θ" },
-        { "phi", L"ϕ" },
-        { "inf", L"∞" },
-        { "to", L"→" },
-        { "delta", L"Δ" },
-        { "epsilon", L"ε" },
-        { "omega", L"ω" },
-        { "lambda", L"λ" },
-        { "mu", L"μ" },
-        { "plusminus", L"±" },
-        { "cross", L"×" },
-        { "dot", L"∙" },
-        { "le", L"≤" },
-        { "ge", L"≥" },
-        { "ell", L"ℓ" },
-        { "alpha", L"α" },
-        { "beta", L"β" },
-        { "gamma", L"γ" },
-        { "Phi", L"Φ" },
-        { "Omega", L"Ω" },
-        { "rho", L"ρ" },
-        { "sigma", L"σ" },
-        { "tau", L"τ" }
-    };
+    g_live.root = root;
+    g_live.w = b.w;
+    g_live.h = b.h;
+    g_live.drawn = true;
 
-    if (unicode_chars.find(fn->fn_name) != unicode_chars.end())
-        return text_unicode(unicode_chars[fn->fn_name]);
+#ifdef __EMSCRIPTEN__
+    g_backend->present();
+#endif
 
-    std::cerr << "Function '" << fn->fn_name << "' does not exist.\n";
-    exit(EXIT_FAILURE);
+#ifndef __EMSCRIPTEN__
+    // The canvas is copied rather than handed over, the next formula is
+    // drawn on top of it
+    std::vector<Uint8> data;
+    bool saved = g_backend->vector() ? g_backend->save(data) : encode::save(g_backend->copy(), data);
+    if (!saved || !encode::write(data, out))
+        std::cerr << "Failed to save '" << out << "'.\n";
+#endif
 }
 
-Drawing draw::text(std::string s)
+SDL_Rect draw::damage()
 {
-    if (s.empty()) s = " ";
-    SDL_Surface *surf = TTF_RenderText_Blended(g_font, s.c_str(), { 0, 0, 0 });
-    SDL_Texture *tex = SDL_CreateTextureFromSurface(g_rend, surf);
-    SDL_FreeSurface(surf);
-
-    int w, h;
-    SDL_QueryTexture(tex, 0, 0, &w, &h);
-    return { tex, w, h };
+    return g_live.damage;
 }
 
-Drawing draw::text_unicode(const std::wstring &s)
+const char *draw::extension()
 {
-    if (s.empty()) return { nullptr };
-    SDL_Surface *surf = TTF_RenderUNICODE_Blended(g_font, (const Uint16*)s.c_str(), { 0, 0, 0 });
-    SDL_Texture *tex = SDL_CreateTextureFromSurface(g_rend, surf);
-    SDL_FreeSurface(surf);
-
-    int w, h;
-    SDL_QueryTexture(tex, 0, 0, &w, &h);
-    return { tex, w, h };
+    return g_backend->extension();
 }
 
-Drawing draw::functions::frac(const Node *fn)
+std::shared_ptr<TTF_Font> draw::font(int size)
 {
-    Drawing top = draw_expr(fn->fn_args[0].get());
-    Drawing bot = draw_expr(fn->fn_args[1].get());
-    top.resize(.5f);
-    bot.resize(.5f);
-
-    int w = std::max(top.w, bot.w);
-    int h = top.h + bot.h + 5;
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_Rect rtop = { (w - top.w) / 2, 0, top.w, top.h };
-    SDL_RenderCopy(g_rend, top.tex, 0, &rtop);
-    SDL_Rect rbot = { (w - bot.w) / 2, top.h + 5, bot.w, bot.h };
-    SDL_RenderCopy(g_rend, bot.tex, 0, &rbot);
-
-    SDL_SetRenderDrawColor(g_rend, 0, 0, 0, 255);
-    SDL_Rect rdiv = { 0, top.h + 2, w, 2 };
-    SDL_RenderFillRect(g_rend, &rdiv);
-
-    SDL_DestroyTexture(top.tex);
-    SDL_DestroyTexture(bot.tex);
-    return { tex, w, h };
-}
+    // Lives as long as the font is open, which outlasts every draw
+    if (size == g_font_size)
+        return std::shared_ptr<TTF_Font>(g_font, [](TTF_Font*) {});
 
-Drawing draw::functions::sum(const Node *fn)
-{
-    Drawing sigma = { IMG_LoadTexture(g_rend, "res/sigma.png"), 70, 70 };
-    Drawing bot = draw_expr(fn->fn_args[0].get());
-    Drawing top = draw_expr(fn->fn_args[1].get());
-    bot.resize(.5f);
-    top.resize(.5f);
-
-    int maxw = std::max(70, std::max(top.w, bot.w));
-    SDL_Rect rsigma = {
-        maxw / 2 - 70 / 2,
-        top.h, 70, 70 };
-    int w = std::max(rsigma.w, std::max(bot.w, top.w));
-    int h = rsigma.h + bot.h + top.h;
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_RenderCopy(g_rend, sigma.tex, 0, &rsigma);
-
-    SDL_Rect rtop = { maxw / 2 - top.w / 2, 0, top.w, top.h };
-    SDL_RenderCopy(g_rend, top.tex, 0, &rtop);
-    SDL_Rect rbot = { maxw / 2 - bot.w / 2, top.h + rsigma.h, bot.w, bot.h };
-    SDL_RenderCopy(g_rend, bot.tex, 0, &rbot);
-
-    SDL_DestroyTexture(sigma.tex);
-    SDL_DestroyTexture(bot.tex);
-    SDL_DestroyTexture(top.tex);
-
-    return { tex, w, h };
+    std::lock_guard<std::mutex> lock(g_fonts_mutex);
+    auto it = g_fonts.find(size);
+    if (it == g_fonts.end())
+    {
+        if (g_fonts.size() >= g_max_fonts)
+        {
+            auto oldest = std::min_element(g_fonts.begin(), g_fonts.end(),
+                [](const auto &a, const auto &b) { return a.second.used < b.second.used; });
+            g_fonts.erase(oldest);
+        }
+
+        TTF_Font *f = resources::font(size);
+        std::shared_ptr<TTF_Font> font;
+        if (f)
+            font.reset(f, TTF_CloseFont);
+        it = g_fonts.emplace(size, SizedFont{ font }).first;
+    }
+
+    it->second.used = ++g_fonts_clock;
+    return it->second.font;
 }
 
-Drawing draw::functions::integral(const Node *fn)
+Image draw::render(Backend &be, const Ast &ast, size_t threads)
 {
-    Drawing sign = { IMG_LoadTexture(g_rend, "res/integral.png"), 0, 0 };
-    SDL_QueryTexture(sign.tex, 0, 0, &sign.w, &sign.h);
-    sign.resize(2.f);
-    return sign;
+    layout::Layout l(be.vector());
+    l.build(ast);
+    const layout::Box &b = l.box(l.root());
+
+    be.begin(b.w, b.h);
+    raster_parallel(be, l, l.root(), { 0, 0, b.w, b.h }, threads);
+    return be.read();
 }
 
-Drawing draw::functions::ointegral(const Node *fn)
+// Where child i of a group drawn at dst ends up
+static SDL_Rect child_rect(const layout::Layout &l, const layout::Box &b, const SDL_Rect &dst, size_t i)
 {
-    Drawing sign = { IMG_LoadTexture(g_rend, "res/ointegral.png"), 0, 0 };
-    SDL_QueryTexture(sign.tex, 0, 0, &sign.w, &sign.h);
-    sign.resize(2.f);
-    return sign;
+    float sx = b.w ? (float)dst.w / b.w : 1.f;
+    float sy = b.h ? (float)dst.h / b.h : 1.f;
+
+    const SDL_Rect &r = l.children(b)[i].rect;
+    return {
+        dst.x + (int)(r.x * sx), dst.y + (int)(r.y * sy),
+        (int)(r.w * sx), (int)(r.h * sy)
+    };
 }
 
-Drawing draw::functions::lim(const Node *fn)
+namespace
 {
-    Drawing lim = text("lim");
-    Drawing bot = draw_expr(fn->fn_args[0].get());
-    lim.resize(.6f);
-    bot.resize(.4f);
-
-    int w = std::max(lim.w, bot.w);
-    int h = lim.h + bot.h;
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_Rect rbot = { lim.w < bot.w ? 0 : lim.w / 2 - bot.w / 2, lim.h - bot.h / 2, bot.w, bot.h };
-    SDL_RenderCopy(g_rend, bot.tex, 0, &rbot);
-    SDL_Rect rlim = { lim.w < bot.w ? bot.w / 2 - lim.w / 2 : 0, 0, lim.w, lim.h };
-    SDL_RenderCopy(g_rend, lim.tex, 0, &rlim);
-
-    SDL_DestroyTexture(lim.tex);
-    SDL_DestroyTexture(bot.tex);
-
-    return { tex, w, h };
+    // Lines can run in any direction, so their rects can be flipped
+    SDL_Rect bounds(SDL_Rect r)
+    {
+        if (r.w < 0)
+        {
+            r.x += r.w;
+            r.w = -r.w;
+        }
+
+        if (r.h < 0)
+        {
+            r.y += r.h;
+            r.h = -r.h;
+        }
+
+        return r;
+    }
+
+    // Glyphs and strokes can spill a little outside of their box
+    SDL_Rect spill(const SDL_Rect &dst)
+    {
+        SDL_Rect r = bounds(dst);
+        int margin = r.h / 2 + 2;
+        return { r.x - margin, r.y - margin, r.w + 2 * margin, r.h + 2 * margin };
+    }
+
+    // Walks down from id and lists every box where stop says so, and every
+    // box that isn't a group, in paint order
+    void collect(const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+        const std::function<bool(layout::BoxId)> &stop, std::vector<Piece> &out)
+    {
+        // Children are pushed last first so they come off in order
+        std::vector<Piece> stack{ { id, dst } };
+        while (!stack.empty())
+        {
+            Piece p = stack.back();
+            stack.pop_back();
+
+            const layout::Box &b = l.box(p.box);
+            if (b.type != layout::BoxType::GROUP || stop(p.box))
+            {
+                out.push_back(p);
+                continue;
+            }
+
+            for (size_t i = b.count; i-- > 0;)
+                stack.push_back({ l.children(b)[i].box, child_rect(l, b, p.dst, i) });
+        }
+    }
+
+    // Draws a box that isn't a group
+    void raster_leaf(draw::Backend &be, const layout::Box &b, const SDL_Rect &dst)
+    {
+        float sx = b.w ? (float)dst.w / b.w : 1.f;
+        float sy = b.h ? (float)dst.h / b.h : 1.f;
+
+        switch (b.type)
+        {
+        case layout::BoxType::TEXT:
+        {
+            // Glyphs are rasterized at the size they are shown at instead of
+            // being shrunk from the layout size, only their positions are
+            // scaled to match the layout
+            int size = std::clamp((int)std::lround(b.size * sy), 1, 4 * b.size);
+            std::shared_ptr<TTF_Font> sized = draw::font(size);
+            TTF_Font *font = sized.get();
+            bool exact = font != nullptr;
+            if (!exact)
+            {
+                font = g_font;
+                size = b.size;
+            }
+
+            float fx = sx * b.size / size;
+            auto place = [&](const Glyph &g, int x) {
+                SDL_Rect quad = { dst.x + (int)(x * fx), dst.y, g.src.w, g.src.h };
+                if (!exact)
+                {
+                    quad.w = g.src.w * sx;
+                    quad.h = g.src.h * sy;
+                }
+
+                be.glyph(g, quad);
+            };
+
+            // Vector backends write the glyphs as text, they only need to
+            // know where they go
+            if (be.vector())
+                metrics_run(font, size, b.text, place);
+            else
+                g_atlas.run(font, size, b.text, place);
+            break;
+        }
+        case layout::BoxType::PATH:
+            be.path(b.path.transformed(dst.x, dst.y, sx, sy));
+            break;
+        case layout::BoxType::RULE:
+            be.fill(dst);
+            break;
+        case layout::BoxType::LINE:
+            be.line(dst.x, dst.y, dst.x + dst.w, dst.y + dst.h);
+            break;
+        case layout::BoxType::GROUP:
+            break;
+        }
+    }
+
+    // Draws every box on stack and everything under them, top of the stack
+    // first. Uses stack for the boxes still to draw instead of recursing, so
+    // no formula is too deep to draw.
+    void raster_stack(draw::Backend &be, const layout::Layout &l, std::vector<Piece> &stack,
+        const SDL_Rect *clip)
+    {
+        while (!stack.empty())
+        {
+            Piece p = stack.back();
+            stack.pop_back();
+
+            if (clip)
+            {
+                SDL_Rect r = spill(p.dst);
+                if (!SDL_HasIntersection(&r, clip))
+                    continue;
+            }
+
+            const layout::Box &b = l.box(p.box);
+            if (b.type != layout::BoxType::GROUP)
+            {
+                raster_leaf(be, b, p.dst);
+                continue;
+            }
+
+            for (size_t i = b.count; i-- > 0;)
+                stack.push_back({ l.children(b)[i].box, child_rect(l, b, p.dst, i) });
+        }
+    }
+
+    // Draws children [first, last) of the group id drawn at dst
+    void raster_children(draw::Backend &be, const layout::Layout &l, layout::BoxId id,
+        const SDL_Rect &dst, size_t first, size_t last)
+    {
+        const layout::Box &b = l.box(id);
+
+        std::vector<Piece> stack;
+        for (size_t i = last; i-- > first;)
+            stack.push_back({ l.children(b)[i].box, child_rect(l, b, dst, i) });
+
+        raster_stack(be, l, stack, nullptr);
+    }
 }
 
-Drawing draw::functions::vec(const Node *fn)
+#ifndef __EMSCRIPTEN__
+namespace
 {
-    Drawing term = draw_expr(fn->fn_args[0].get());
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        term.w, term.h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_Rect rterm = { 0, 0, term.w, term.h };
-    SDL_RenderCopy(g_rend, term.tex, 0, &rterm);
-
-    SDL_SetRenderDrawColor(g_rend, 0, 0, 0, 255);
-    int w = term.w;
-    SDL_RenderDrawLine(g_rend, 0, 4, w, 4);
-    SDL_RenderDrawLine(g_rend, 0, 5, w, 5);
-    SDL_RenderDrawLine(g_rend, w, 4, w - 4, 0);
-    SDL_RenderDrawLine(g_rend, w, 5, w - 5, 0);
-    SDL_RenderDrawLine(g_rend, w, 4, w - 4, 8);
-    SDL_RenderDrawLine(g_rend, w, 5, w - 5, 10);
-
-    SDL_DestroyTexture(term.tex);
-    return { tex, term.w, term.h };
+    // Draws id a band of g_band_rows rows at a time and streams every band
+    // into the encoder as it's done. Formats that pick their colours from
+    // the whole image get every band drawn twice, once to scan it.
+    bool save_bands(draw::Backend &be, const layout::Layout &l, layout::BoxId id,
+        const std::string &path)
+    {
+        const layout::Box &b = l.box(id);
+        std::unique_ptr<encode::Encoder> enc = encode::make_encoder(b.w, b.h);
+        encode::Output out;
+        if (!enc || !out.open(path))
+            return false;
+
+        std::vector<Uint8> data;
+        for (int pass = enc->needs_scan() ? 0 : 1; pass < 2; ++pass)
+        {
+            for (int y = 0; y < b.h; y += g_band_rows)
+            {
+                int h = std::min(g_band_rows, b.h - y);
+                SDL_Rect clip = { 0, 0, b.w, h };
+
+                be.begin(b.w, h);
+                {
+                    trace::Scope scope("raster band");
+                    draw::raster(be, l, id, { 0, -y, b.w, b.h }, &clip);
+                }
+
+                Image band = be.read();
+                if (pass == 0)
+                {
+                    enc->scan(band);
+                    continue;
+                }
+
+                data.clear();
+                {
+                    trace::Scope scope("encode");
+                    if (!enc->add(band, data))
+                        return false;
+                }
+
+                if (!out.write(data))
+                    return false;
+            }
+        }
+
+        data.clear();
+        return enc->finish(data) && out.write(data) && out.close();
+    }
 }
+#endif
 
-Drawing draw::functions::sqrt(const Node *fn)
+void draw::raster(Backend &be, const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+    const SDL_Rect *clip)
 {
-    Drawing term = draw_expr(fn->fn_args[0].get());
-    int w = term.w + 10;
-    int h = term.h;
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_Rect rterm = { 10, 0, term.w, term.h };
-    SDL_RenderCopy(g_rend, term.tex, 0, &rterm);
-
-    SDL_SetRenderDrawColor(g_rend, 0, 0, 0, 255);
-    SDL_RenderDrawLine(g_rend, 0, h - 20, 8, h);
-    SDL_RenderDrawLine(g_rend, 0, h - 19, 9, h);
-    SDL_RenderDrawLine(g_rend, 8, 0, 8, h);
-    SDL_RenderDrawLine(g_rend, 7, 0, 7, h);
-    SDL_RenderDrawLine(g_rend, 8, 0, w, 0);
-    SDL_RenderDrawLine(g_rend, 8, 1, w, 1);
-
-    SDL_DestroyTexture(term.tex);
-    return { tex, w, h };
+    std::vector<Piece> stack{ { id, dst } };
+    raster_stack(be, l, stack, clip);
 }
 
-Drawing draw::functions::exponent(const Node *fn)
+namespace
 {
-    Drawing base = draw_expr(fn->fn_args[0].get());
-    Drawing exp = draw_expr(fn->fn_args[1].get());
-
-    exp.resize(.5f);
-    int w = base.w + exp.w;
-    int h = base.h;
-
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
-
-    SDL_Rect rbase = { 0, 0, base.w, base.h };
-    SDL_RenderCopy(g_rend, base.tex, 0, &rbase);
-    SDL_Rect rexp = { base.w, 0, exp.w, exp.h };
-    SDL_RenderCopy(g_rend, exp.tex, 0, &rexp);
+    // Consecutive children [first, last) of a group, drawn into their own layer
+    struct Task
+    {
+        layout::BoxId parent;
+        SDL_Rect dst;
+        size_t first, last;
+        SDL_Rect area;
+    };
 
-    SDL_DestroyTexture(base.tex);
-    SDL_DestroyTexture(exp.tex);
+    void add_task(const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+        size_t first, size_t last, std::vector<Task> &tasks)
+    {
+        if (first == last)
+            return;
+
+        const layout::Box &b = l.box(id);
+        SDL_Rect area = bounds(child_rect(l, b, dst, first));
+        for (size_t i = first + 1; i < last; ++i)
+        {
+            SDL_Rect r = bounds(child_rect(l, b, dst, i));
+            SDL_UnionRect(&area, &r, &area);
+        }
+
+        tasks.push_back({ id, dst, first, last, spill(area) });
+    }
 
-    return { tex, w, h };
+    // Splits the children of a group into runs of about target cost, going
+    // down into any child that is too expensive on its own. Tasks come out in
+    // paint order.
+    void split(const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+        size_t target, std::vector<Task> &tasks)
+    {
+        // A group being split, children before next are done and the ones
+        // from first on aren't in a task yet
+        struct Run
+        {
+            layout::BoxId id;
+            SDL_Rect dst;
+            size_t next, first, cost;
+        };
+
+        std::vector<Run> stack{ { id, dst, 0, 0, 0 } };
+        while (!stack.empty())
+        {
+            Run &r = stack.back();
+            const layout::Box &b = l.box(r.id);
+
+            if (r.next == b.count)
+            {
+                add_task(l, r.id, r.dst, r.first, b.count, tasks);
+                stack.pop_back();
+                continue;
+            }
+
+            size_t i = r.next++;
+            const layout::Placement &child = l.children(b)[i];
+            const layout::Box &c = l.box(child.box);
+
+            if (c.type == layout::BoxType::GROUP && c.cost > target)
+            {
+                add_task(l, r.id, r.dst, r.first, i, tasks);
+                r.first = i + 1;
+                r.cost = 0;
+                stack.push_back({ child.box, child_rect(l, b, r.dst, i), 0, 0, 0 });
+                continue;
+            }
+
+            r.cost += c.cost;
+            if (r.cost >= target)
+            {
+                add_task(l, r.id, r.dst, r.first, i + 1, tasks);
+                r.first = i + 1;
+                r.cost = 0;
+            }
+        }
+    }
 }
 
-Drawing draw::functions::subscript(const Node *fn)
+void draw::raster_parallel(Backend &be, const layout::Layout &l, layout::BoxId id,
+    const SDL_Rect &dst, size_t threads)
 {
-    Drawing base = draw_expr(fn->fn_args[0].get());
-    Drawing sub = draw_expr(fn->fn_args[1].get());
-
-    sub.resize(.5f);
-    int w = base.w + sub.w;
-    int h = base.h;
-
-    SDL_Texture *tex = SDL_CreateTexture(g_rend,
-        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-        w, h);
-    SDL_SetRenderTarget(g_rend, tex);
-    SDL_SetRenderDrawColor(g_rend, 255, 255, 255, 255);
-    SDL_RenderFillRect(g_rend, 0);
+    trace::Scope scope("raster");
+    const layout::Box &b = l.box(id);
+    if (threads <= 1 || !be.supports_layers() || b.type != layout::BoxType::GROUP ||
+        b.cost < g_parallel_cost)
+    {
+        raster(be, l, id, dst);
+        return;
+    }
 
-    SDL_Rect rbase = { 0, 0, base.w, base.h };
-    SDL_RenderCopy(g_rend, base.tex, 0, &rbase);
-    SDL_Rect rsub = { base.w, base.h - sub.h, sub.w, sub.h };
-    SDL_RenderCopy(g_rend, sub.tex, 0, &rsub);
+    std::vector<Task> tasks;
+    split(l, id, dst, b.cost / (threads * 4), tasks);
 
-    SDL_DestroyTexture(base.tex);
-    SDL_DestroyTexture(sub.tex);
+    // With a budget, layers are drawn a run at a time so the ones that are
+    // alive together fit in it along with the canvas. Each run is
+    // composited and handed back before the next one starts.
+    auto bytes = [](const Task &t) { return (size_t)t.area.w * t.area.h * 4; };
+    size_t canvas = (size_t)dst.w * dst.h * 4;
 
-    return { tex, w, h };
+    std::vector<std::unique_ptr<Backend>> layers;
+    for (size_t first = 0, last; first < tasks.size(); first = last)
+    {
+        size_t used = canvas + bytes(tasks[first]);
+        for (last = first + 1; last < tasks.size(); ++last)
+        {
+            if (pool::g_budget && used + bytes(tasks[last]) > pool::g_budget)
+                break;
+
+            used += bytes(tasks[last]);
+        }
+
+        layers.resize(last - first);
+        pipeline::parallel_for(last - first, threads, [&](size_t i) {
+            const Task &t = tasks[first + i];
+            layers[i] = be.layer(t.area);
+            raster_children(*layers[i], l, t.parent, t.dst, t.first, t.last);
+        });
+
+        for (auto &layer : layers)
+        {
+            be.composite(*layer);
+            layer.reset();
+        }
+    }
 }
-
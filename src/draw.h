@@ -1,43 +1,56 @@
 #pragma once
 #include "node.h"
+#include "layout.h"
+#include "backend.h"
+#include <memory>
 #include <SDL2/SDL.h>
-
-struct Drawing
-{
-    SDL_Texture *tex{ nullptr };
-    int w, h;
-
-    void resize(float s)
-    {
-        w *= s;
-        h *= s;
-    }
-};
+#include <SDL2/SDL_ttf.h>
 
 namespace draw
 {
-    void init();
+    // backend is one of "sdl", "cpu" or "svg", threads is how many threads
+    // draw a single formula (0 for one per core)
+    void init(const std::string &backend, size_t threads = 0);
     void quit();
 
-    void draw(const Node *root, bool ask_filename = true);
-    Drawing draw_expr(const Node *expr);
-    Drawing compound(const Node *cpd);
-    Drawing fn(const Node *fn);
-    Drawing text(std::string s);
-    Drawing text_unicode(const std::wstring &s);
+    // Opens the font for layout and drawing without making a backend, for
+    // callers that bring their own. Every open needs a close, the font and
+    // glyph atlas are shared and freed after the last close. Throws
+    // std::runtime_error if the font can't be opened. Safe to call from any
+    // thread.
+    void open();
+    void close();
+    // Reopens the font and drops every cached glyph. If the font can't be
+    // opened the old one stays and false is returned. No other thread may
+    // be drawing.
+    bool reload();
 
-    namespace functions
-    {
-        Drawing frac(const Node *fn);
-        Drawing sum(const Node *fn);
-        Drawing integral(const Node *fn);
-        Drawing ointegral(const Node *fn);
-        Drawing lim(const Node *fn);
-        Drawing vec(const Node *fn);
-        Drawing sqrt(const Node *fn);
+    // Draws ast and saves it to out, or shows it in the emscripten build.
+    // The previous formula is kept, so an edited one only lays out and
+    // redraws the parts that changed.
+    void draw(const Ast &ast, const std::string &out);
+    // Part of the canvas the last draw painted, all of it unless the formula
+    // before was kept and only what changed was drawn again
+    SDL_Rect damage();
+    // Extension of the files draw saves, without the dot
+    const char *extension();
 
-        Drawing exponent(const Node *fn);
-        Drawing subscript(const Node *fn);
-    }
-}
+    // The font opened at size pixels. Sizes other than the layout size are
+    // opened on first use, the few used most recently are kept open until
+    // reload or quit and the others are closed once nobody holds them. Safe
+    // to call from any thread, returns nullptr if the font can't be opened.
+    std::shared_ptr<TTF_Font> font(int size);
+    // Lays out and rasterizes ast with be, returns the finished canvas
+    Image render(Backend &be, const Ast &ast, size_t threads = 1);
+
+    // Draws a laid out box and all of its children with be, stretching it
+    // to fill dst. Subtrees that can't reach clip are skipped if it's given.
+    void raster(Backend &be, const layout::Layout &l, layout::BoxId id, const SDL_Rect &dst,
+        const SDL_Rect *clip = nullptr);
 
+    // Same as raster, but large formulas are split into independent runs of
+    // subtrees that are drawn into layers on separate threads and then
+    // composited in order. Falls back to raster if be has no layers.
+    void raster_parallel(Backend &be, const layout::Layout &l, layout::BoxId id,
+        const SDL_Rect &dst, size_t threads);
+}
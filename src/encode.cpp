@@ -0,0 +1,802 @@
+#include "encode.h"
+#include "hash.h"
+#include "trace.h"
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include <zlib.h>
+#include <SDL2/SDL_image.h>
+
+encode::Options encode::g_options;
+
+namespace
+{
+    void put_u32(std::vector<Uint8> &out, Uint32 v)
+    {
+        for (int i = 3; i >= 0; --i)
+            out.push_back(v >> (8 * i) & 255);
+    }
+
+    void put_str(std::vector<Uint8> &out, const std::string &s)
+    {
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    Uint32 rgba_at(const Image &img, size_t i)
+    {
+        const Uint8 *p = &img.pixels[i * 4];
+        return (Uint32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    // How a PNG stores the image after reduction
+    struct Layout
+    {
+        // PNG colour type, 0 gray, 2 RGB, 3 palette or 6 RGBA
+        int type{ 6 };
+        int depth{ 8 };
+        // Packed RGBA like rgba_at, for type 3
+        std::vector<Uint32> palette;
+        std::unordered_map<Uint32, Uint8> index;
+
+        // What scan has seen so far
+        bool opaque{ true }, gray{ true };
+        size_t scanned{ 0 };
+        Uint32 last{ 0 };
+
+        int channels() const
+        {
+            switch (type)
+            {
+            case 0: case 3: return 1;
+            case 2: return 3;
+            default: return 4;
+            }
+        }
+    };
+
+    // Gathers the colours of the next band of the image into l
+    void scan(Layout &l, const Image &band)
+    {
+        size_t n = (size_t)band.w * band.h;
+        for (size_t i = 0; i < n; ++i, ++l.scanned)
+        {
+            const Uint8 *p = &band.pixels[i * 4];
+            l.opaque &= p[3] == 255;
+            l.gray &= p[0] == p[1] && p[1] == p[2];
+
+            // Neighbours are usually the same colour
+            Uint32 c = rgba_at(band, i);
+            if ((l.scanned && c == l.last) || l.palette.size() > 256)
+                continue;
+
+            l.last = c;
+            if (l.index.try_emplace(c, l.palette.size()).second)
+                l.palette.push_back(c);
+        }
+    }
+
+    // Picks the smallest layout for the colours scan found
+    void reduce(Layout &l)
+    {
+        size_t colours = l.palette.size();
+        if (colours <= 16 || (colours <= 256 && !(l.gray && l.opaque)))
+        {
+            l.type = 3;
+            l.depth = colours <= 2 ? 1 : colours <= 4 ? 2 : colours <= 16 ? 4 : 8;
+            return;
+        }
+
+        l.palette.clear();
+        l.index.clear();
+
+        if (l.gray && l.opaque)
+            l.type = 0;
+        else if (l.opaque)
+            l.type = 2;
+    }
+
+    // Unfiltered scanline y as the PNG stores it
+    void scanline(const Image &img, const Layout &l, int y, std::vector<Uint8> &row)
+    {
+        std::fill(row.begin(), row.end(), 0);
+        const Uint8 *p = &img.pixels[(size_t)y * img.w * 4];
+
+        for (int x = 0; x < img.w; ++x, p += 4)
+        {
+            switch (l.type)
+            {
+            case 0:
+                row[x] = p[0];
+                break;
+            case 2:
+                std::copy(p, p + 3, &row[x * 3]);
+                break;
+            case 3:
+            {
+                Uint8 i = l.index.at(rgba_at(img, (size_t)y * img.w + x));
+                int bit = x * l.depth;
+                row[bit / 8] |= i << (8 - l.depth - bit % 8);
+                break;
+            }
+            default:
+                std::copy(p, p + 4, &row[x * 4]);
+                break;
+            }
+        }
+    }
+
+    Uint8 paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+
+    // Filters row against the row above it into out, which starts with the
+    // filter type byte
+    void apply(int filter, const std::vector<Uint8> &row, const std::vector<Uint8> &prev,
+        size_t bpp, std::vector<Uint8> &out)
+    {
+        out[0] = filter;
+        for (size_t i = 0; i < row.size(); ++i)
+        {
+            int a = i >= bpp ? row[i - bpp] : 0;
+            int b = prev[i];
+            int c = i >= bpp ? prev[i - bpp] : 0;
+
+            switch (filter)
+            {
+            case 0: out[i + 1] = row[i]; break;
+            case 1: out[i + 1] = row[i] - a; break;
+            case 2: out[i + 1] = row[i] - b; break;
+            case 3: out[i + 1] = row[i] - (a + b) / 2; break;
+            case 4: out[i + 1] = row[i] - paeth(a, b, c); break;
+            }
+        }
+    }
+
+    // Sum of the filtered bytes as signed values, the usual guess at which
+    // filter compresses best
+    size_t cost(const std::vector<Uint8> &filtered)
+    {
+        size_t sum = 0;
+        for (size_t i = 1; i < filtered.size(); ++i)
+            sum += std::abs((int)(Sint8)filtered[i]);
+
+        return sum;
+    }
+
+    void chunk(std::vector<Uint8> &out, const char *type, const std::vector<Uint8> &data)
+    {
+        put_u32(out, data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        put_u32(out, crc32(0, &out[start], out.size() - start));
+    }
+
+    // Compressed data is held back until there is this much, so small
+    // images get a single IDAT and tall ones a few large ones
+    const size_t g_idat_size = 1 << 18;
+
+    class Png : public encode::Encoder
+    {
+    public:
+        Png(int w, int h, const encode::Options &opts)
+            : m_w(w), m_h(h), m_opts(opts)
+        {
+        }
+
+        ~Png()
+        {
+            if (m_started)
+                deflateEnd(&m_zs);
+        }
+
+        bool needs_scan() const override { return m_opts.reduce; }
+        void scan(const Image &band) override { ::scan(m_layout, band); }
+
+        bool add(const Image &band, std::vector<Uint8> &out) override
+        {
+            if (!m_started && !start(out))
+                return false;
+
+            std::vector<Uint8> &raw = m_raw;
+            raw.clear();
+            raw.reserve((m_stride + 1) * band.h);
+
+            for (int y = 0; y < band.h; ++y)
+            {
+                scanline(band, m_layout, y, m_row);
+
+                if (m_filter == encode::Filter::ADAPTIVE)
+                {
+                    size_t best_cost = SIZE_MAX;
+                    for (int f = 0; f < 5; ++f)
+                    {
+                        apply(f, m_row, m_prev, m_bpp, m_tmp);
+                        size_t c = cost(m_tmp);
+                        if (c < best_cost)
+                        {
+                            best_cost = c;
+                            std::swap(m_best, m_tmp);
+                        }
+                    }
+                }
+                else
+                {
+                    apply((int)m_filter, m_row, m_prev, m_bpp, m_best);
+                }
+
+                raw.insert(raw.end(), m_best.begin(), m_best.end());
+                std::swap(m_row, m_prev);
+            }
+
+            if (!compress(raw, Z_NO_FLUSH))
+                return false;
+
+            if (m_idat.size() >= g_idat_size)
+            {
+                chunk(out, "IDAT", m_idat);
+                m_idat.clear();
+            }
+
+            return true;
+        }
+
+        bool finish(std::vector<Uint8> &out) override
+        {
+            if (!m_started && !start(out))
+                return false;
+
+            if (!compress({}, Z_FINISH))
+                return false;
+
+            chunk(out, "IDAT", m_idat);
+            chunk(out, "IEND", {});
+            return true;
+        }
+
+    private:
+        // Picks the layout and filter and writes everything before IDAT
+        bool start(std::vector<Uint8> &out)
+        {
+            m_started = true;
+
+            Layout &l = m_layout;
+            if (m_opts.reduce)
+                reduce(l);
+
+            m_stride = ((size_t)m_w * l.channels() * l.depth + 7) / 8;
+            m_bpp = std::max(1, l.channels() * l.depth / 8);
+            m_row.assign(m_stride, 0);
+            m_prev.assign(m_stride, 0);
+            m_best.assign(m_stride + 1, 0);
+            m_tmp.assign(m_stride + 1, 0);
+
+            // Filters rarely help indexed or packed rows
+            m_filter = m_opts.filter;
+            if (m_filter == encode::Filter::ADAPTIVE && (l.type == 3 || l.depth < 8))
+                m_filter = encode::Filter::NONE;
+
+            int strategy = m_filter == encode::Filter::NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+            if (deflateInit2(&m_zs, std::clamp(m_opts.level, 0, 9), Z_DEFLATED, 15, 8, strategy) != Z_OK)
+            {
+                m_started = false;
+                return false;
+            }
+
+            static const Uint8 signature[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+            out.insert(out.end(), signature, signature + 8);
+
+            std::vector<Uint8> ihdr;
+            put_u32(ihdr, m_w);
+            put_u32(ihdr, m_h);
+            ihdr.insert(ihdr.end(), { (Uint8)l.depth, (Uint8)l.type, 0, 0, 0 });
+            chunk(out, "IHDR", ihdr);
+
+            if (l.type == 3)
+            {
+                std::vector<Uint8> plte, trns;
+                for (Uint32 c : l.palette)
+                {
+                    plte.insert(plte.end(), { (Uint8)(c >> 24), (Uint8)(c >> 16), (Uint8)(c >> 8) });
+                    trns.push_back(c & 255);
+                }
+
+                chunk(out, "PLTE", plte);
+                if (std::any_of(trns.begin(), trns.end(), [](Uint8 a) { return a != 255; }))
+                    chunk(out, "tRNS", trns);
+            }
+
+            return true;
+        }
+
+        // Deflates in into m_idat
+        bool compress(const std::vector<Uint8> &in, int flush)
+        {
+            m_zs.next_in = (Bytef*)in.data();
+            m_zs.avail_in = in.size();
+
+            int rc;
+            do
+            {
+                size_t size = m_idat.size(),
+                    room = deflateBound(&m_zs, m_zs.avail_in) + 64;
+                m_idat.resize(size + room);
+                m_zs.next_out = m_idat.data() + size;
+                m_zs.avail_out = room;
+
+                rc = deflate(&m_zs, flush);
+                m_idat.resize(size + room - m_zs.avail_out);
+            } while (rc == Z_OK && (m_zs.avail_in || (flush == Z_FINISH && m_zs.avail_out == 0)));
+
+            return flush == Z_FINISH ? rc == Z_STREAM_END : rc == Z_OK || rc == Z_BUF_ERROR;
+        }
+
+    private:
+        int m_w, m_h;
+        encode::Options m_opts;
+        bool m_started{ false };
+
+        Layout m_layout;
+        encode::Filter m_filter{ encode::Filter::NONE };
+        size_t m_stride{ 0 }, m_bpp{ 1 };
+        std::vector<Uint8> m_row, m_prev, m_best, m_tmp, m_raw, m_idat;
+        z_stream m_zs{};
+    };
+
+    // https://qoiformat.org/qoi-specification.pdf
+    class Qoi : public encode::Encoder
+    {
+    public:
+        Qoi(int w, int h, const encode::Options &opts)
+            : m_w(w), m_h(h), m_opts(opts)
+        {
+        }
+
+        bool needs_scan() const override { return m_opts.reduce; }
+
+        void scan(const Image &band) override
+        {
+            size_t n = (size_t)band.w * band.h;
+            for (size_t i = 0; i < n && m_opaque; ++i)
+                m_opaque = band.pixels[i * 4 + 3] == 255;
+        }
+
+        bool add(const Image &band, std::vector<Uint8> &out) override
+        {
+            if (!m_started)
+                start(out);
+
+            size_t n = (size_t)m_w * m_h;
+            size_t count = (size_t)band.w * band.h;
+
+            for (size_t j = 0; j < count; ++j, ++m_pos)
+            {
+                const Uint8 *p = &band.pixels[j * 4];
+
+                if (std::equal(p, p + 4, m_prev))
+                {
+                    if (++m_run == 62 || m_pos == n - 1)
+                    {
+                        out.push_back(0xc0 | (m_run - 1));
+                        m_run = 0;
+                    }
+
+                    continue;
+                }
+
+                if (m_run)
+                {
+                    out.push_back(0xc0 | (m_run - 1));
+                    m_run = 0;
+                }
+
+                Uint32 c = rgba_at(band, j);
+                int slot = (p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) % 64;
+
+                if (m_index[slot] == c)
+                {
+                    out.push_back(slot);
+                }
+                else
+                {
+                    m_index[slot] = c;
+
+                    if (p[3] == m_prev[3])
+                    {
+                        int dr = (Sint8)(p[0] - m_prev[0]);
+                        int dg = (Sint8)(p[1] - m_prev[1]);
+                        int db = (Sint8)(p[2] - m_prev[2]);
+                        int dr_dg = dr - dg, db_dg = db - dg;
+
+                        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                            out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                        else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+                            out.insert(out.end(), { (Uint8)(0x80 | (dg + 32)), (Uint8)((dr_dg + 8) << 4 | (db_dg + 8)) });
+                        else
+                            out.insert(out.end(), { 0xfe, p[0], p[1], p[2] });
+                    }
+                    else
+                    {
+                        out.insert(out.end(), { 0xff, p[0], p[1], p[2], p[3] });
+                    }
+                }
+
+                std::copy(p, p + 4, m_prev);
+            }
+
+            return true;
+        }
+
+        bool finish(std::vector<Uint8> &out) override
+        {
+            if (!m_started)
+                start(out);
+
+            out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+            return true;
+        }
+
+    private:
+        void start(std::vector<Uint8> &out)
+        {
+            m_started = true;
+            put_str(out, "qoif");
+            put_u32(out, m_w);
+            put_u32(out, m_h);
+            out.push_back(m_opts.reduce && m_opaque ? 3 : 4);
+            out.push_back(0);
+        }
+
+    private:
+        int m_w, m_h;
+        encode::Options m_opts;
+        bool m_started{ false };
+        bool m_opaque{ true };
+
+        Uint32 m_index[64] = {};
+        Uint8 m_prev[4] = { 0, 0, 0, 255 };
+        int m_run{ 0 };
+        // Pixels encoded so far
+        size_t m_pos{ 0 };
+    };
+
+    // Netpbm has no alpha, the canvas is opaque anyway
+    class Netpbm : public encode::Encoder
+    {
+    public:
+        Netpbm(int w, int h, bool gray)
+            : m_w(w), m_h(h), m_gray(gray)
+        {
+        }
+
+        bool add(const Image &band, std::vector<Uint8> &out) override
+        {
+            if (!m_started)
+                start(out);
+
+            size_t n = (size_t)band.w * band.h;
+            out.reserve(out.size() + n * (m_gray ? 1 : 3));
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                const Uint8 *p = &band.pixels[i * 4];
+                if (m_gray)
+                    out.push_back((p[0] * 299 + p[1] * 587 + p[2] * 114 + 500) / 1000);
+                else
+                    out.insert(out.end(), p, p + 3);
+            }
+
+            return true;
+        }
+
+        bool finish(std::vector<Uint8> &out) override
+        {
+            if (!m_started)
+                start(out);
+
+            return true;
+        }
+
+    private:
+        void start(std::vector<Uint8> &out)
+        {
+            m_started = true;
+            put_str(out, std::string(m_gray ? "P5" : "P6") + "\n" +
+                std::to_string(m_w) + " " + std::to_string(m_h) + "\n255\n");
+        }
+
+    private:
+        int m_w, m_h;
+        bool m_gray;
+        bool m_started{ false };
+    };
+
+    // SDL_RWops writing into a growing buffer
+    struct Sink
+    {
+        std::vector<Uint8> *out;
+        size_t begin, pos;
+    };
+
+    Sint64 sink_size(SDL_RWops *rw)
+    {
+        Sink *s = (Sink*)rw->hidden.unknown.data1;
+        return s->out->size() - s->begin;
+    }
+
+    Sint64 sink_seek(SDL_RWops *rw, Sint64 offset, int whence)
+    {
+        Sink *s = (Sink*)rw->hidden.unknown.data1;
+        Sint64 base = 0;
+        if (whence == RW_SEEK_CUR) base = s->pos - s->begin;
+        if (whence == RW_SEEK_END) base = s->out->size() - s->begin;
+
+        if (base + offset < 0)
+            return -1;
+
+        s->pos = s->begin + base + offset;
+        return base + offset;
+    }
+
+    size_t sink_read(SDL_RWops *, void *, size_t, size_t)
+    {
+        return 0;
+    }
+
+    size_t sink_write(SDL_RWops *rw, const void *ptr, size_t size, size_t num)
+    {
+        Sink *s = (Sink*)rw->hidden.unknown.data1;
+        size_t n = size * num;
+
+        if (s->out->size() < s->pos + n)
+            s->out->resize(s->pos + n);
+
+        std::copy((const Uint8*)ptr, (const Uint8*)ptr + n, s->out->data() + s->pos);
+        s->pos += n;
+        return num;
+    }
+
+    int sink_close(SDL_RWops *rw)
+    {
+        SDL_FreeRW(rw);
+        return 0;
+    }
+
+    // SDL_image's writer with its default settings, what acrylic used to
+    // save with. Only kept around to benchmark against.
+    bool sdl_png(const Image &img, std::vector<Uint8> &out)
+    {
+        SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom((void*)img.pixels.data(),
+            img.w, img.h, 32, img.w * 4, SDL_PIXELFORMAT_RGBA32);
+        if (!surf)
+            return false;
+
+        Sink sink = { &out, out.size(), out.size() };
+        SDL_RWops *rw = SDL_AllocRW();
+        rw->size = sink_size;
+        rw->seek = sink_seek;
+        rw->read = sink_read;
+        rw->write = sink_write;
+        rw->close = sink_close;
+        rw->hidden.unknown.data1 = &sink;
+
+        int rc = IMG_SavePNG_RW(surf, rw, 1);
+        SDL_FreeSurface(surf);
+        return rc == 0;
+    }
+}
+
+bool encode::save(const Image &img, const std::string &path, const Options &opts)
+{
+    std::vector<Uint8> data;
+    return save(img, data, opts) && write(data, path);
+}
+
+bool encode::write(const std::vector<Uint8> &data, const std::string &path)
+{
+    Output out;
+    return out.open(path) && out.write(data) && out.close();
+}
+
+bool encode::Output::open(const std::string &path)
+{
+    m_stdout = path == "-";
+    if (!m_stdout)
+        m_file.open(path, std::ios::binary);
+
+    m_ok = m_stdout || m_file.is_open();
+    return m_ok;
+}
+
+bool encode::Output::write(const std::vector<Uint8> &data)
+{
+    trace::Scope scope("write");
+    trace::count(trace::Counter::BYTES_WRITTEN, data.size());
+
+    if (m_stdout)
+        m_ok &= fwrite(data.data(), 1, data.size(), stdout) == data.size();
+    else
+        m_ok &= (bool)m_file.write((const char*)data.data(), data.size());
+
+    return m_ok;
+}
+
+bool encode::Output::close()
+{
+    if (m_stdout)
+    {
+        m_ok &= fflush(stdout) == 0;
+    }
+    else if (m_file.is_open())
+    {
+        m_file.close();
+        m_ok &= !m_file.fail();
+    }
+
+    return m_ok;
+}
+
+bool encode::save(const Image &img, std::vector<Uint8> &out, const Options &opts)
+{
+    trace::Scope scope("encode");
+    std::unique_ptr<Encoder> e = make_encoder(img.w, img.h, opts);
+
+    if (e->needs_scan())
+        e->scan(img);
+
+    return e->add(img, out) && e->finish(out);
+}
+
+std::unique_ptr<encode::Encoder> encode::make_encoder(int w, int h, const Options &opts)
+{
+    switch (opts.format)
+    {
+    case Format::PNG: return std::make_unique<Png>(w, h, opts);
+    case Format::QOI: return std::make_unique<Qoi>(w, h, opts);
+    case Format::PPM: return std::make_unique<Netpbm>(w, h, false);
+    case Format::PGM: return std::make_unique<Netpbm>(w, h, true);
+    }
+
+    return nullptr;
+}
+
+bool encode::parse_format(const std::string &name, Format &format)
+{
+    static const std::pair<const char*, Format> names[] = {
+        { "png", Format::PNG },
+        { "qoi", Format::QOI },
+        { "ppm", Format::PPM },
+        { "pgm", Format::PGM }
+    };
+
+    for (const auto &[n, f] : names)
+    {
+        if (name == n)
+        {
+            format = f;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool encode::parse_filter(const std::string &name, Filter &filter)
+{
+    static const std::pair<const char*, Filter> names[] = {
+        { "none", Filter::NONE },
+        { "sub", Filter::SUB },
+        { "up", Filter::UP },
+        { "average", Filter::AVERAGE },
+        { "paeth", Filter::PAETH },
+        { "adaptive", Filter::ADAPTIVE }
+    };
+
+    for (const auto &[n, f] : names)
+    {
+        if (name == n)
+        {
+            filter = f;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *encode::extension(Format format)
+{
+    switch (format)
+    {
+    case Format::PNG: return "png";
+    case Format::QOI: return "qoi";
+    case Format::PPM: return "ppm";
+    case Format::PGM: return "pgm";
+    }
+
+    return "";
+}
+
+Uint64 encode::fingerprint(const Options &opts)
+{
+    Uint64 h = hash::combine(hash::g_offset, (Uint64)opts.format);
+    if (opts.format == Format::PNG)
+    {
+        h = hash::combine(h, opts.level);
+        h = hash::combine(h, (Uint64)opts.filter);
+    }
+
+    return hash::combine(h, opts.reduce);
+}
+
+void encode::benchmark(const Image &img, std::ostream &out)
+{
+    struct Run
+    {
+        std::string name;
+        std::function<bool(std::vector<Uint8>&)> encode;
+    };
+
+    std::vector<Run> runs;
+    runs.push_back({ "png sdl_image", [&](std::vector<Uint8> &o) { return sdl_png(img, o); } });
+
+    static const char *filters[] = { "none", "sub", "up", "average", "paeth", "adaptive" };
+    for (int level : { 1, 6, 9 })
+    {
+        for (int f : { 0, 4, 5 })
+        {
+            Options opts;
+            opts.level = level;
+            opts.filter = (Filter)f;
+            runs.push_back({ "png level " + std::to_string(level) + " " + filters[f],
+                [&img, opts](std::vector<Uint8> &o) { return save(img, o, opts); } });
+        }
+    }
+
+    Options full;
+    full.reduce = false;
+    runs.push_back({ "png level 6 adaptive rgba", [&img, full](std::vector<Uint8> &o) { return save(img, o, full); } });
+
+    for (Format f : { Format::QOI, Format::PPM, Format::PGM })
+    {
+        Options opts;
+        opts.format = f;
+        runs.push_back({ extension(f), [&img, opts](std::vector<Uint8> &o) { return save(img, o, opts); } });
+    }
+
+    out << img.w << "x" << img.h << " image, best of 5\n";
+    out << std::left << std::setw(28) << "encoder" << std::right << std::setw(10) << "bytes"
+        << std::setw(10) << "ms" << "\n";
+
+    for (const auto &r : runs)
+    {
+        std::vector<Uint8> data;
+        double best = 1e9;
+        bool ok = true;
+
+        for (int i = 0; i < 5; ++i)
+        {
+            data.clear();
+            auto begin = std::chrono::steady_clock::now();
+            ok &= r.encode(data);
+            std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now() - begin;
+            best = std::min(best, t.count());
+        }
+
+        out << std::left << std::setw(28) << r.name << std::right << std::setw(10);
+        if (ok)
+            out << data.size() << std::setw(10) << std::fixed << std::setprecision(3) << best << "\n";
+        else
+            out << "failed" << "\n";
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "image.h"
+#include <memory>
+#include <string>
+#include <ostream>
+#include <fstream>
+
+namespace encode
+{
+    enum class Format
+    {
+        PNG,
+        QOI,
+        // Binary netpbm, RGB and gray
+        PPM,
+        PGM
+    };
+
+    // PNG scanline filter, ADAPTIVE picks the best one for every row
+    enum class Filter
+    {
+        NONE,
+        SUB,
+        UP,
+        AVERAGE,
+        PAETH,
+        ADAPTIVE
+    };
+
+    struct Options
+    {
+        Format format{ Format::PNG };
+
+        // zlib level for PNG, 0 stores and 9 compresses hardest
+        int level{ 6 };
+        Filter filter{ Filter::ADAPTIVE };
+
+        // Stores PNG and QOI with as few channels and colours as the image
+        // allows, formulas are nearly always gray or a handful of colours
+        bool reduce{ true };
+    };
+
+    // Used whenever no options are given, set once at startup
+    extern Options g_options;
+
+    // Writes img to path, or to stdout if path is "-". Returns false if it
+    // couldn't be written.
+    bool save(const Image &img, const std::string &path, const Options &opts = g_options);
+    // Appends the encoded image to out
+    bool save(const Image &img, std::vector<Uint8> &out, const Options &opts = g_options);
+    // Writes already encoded data to path, or to stdout if path is "-"
+    bool write(const std::vector<Uint8> &data, const std::string &path);
+
+    // Encodes an image handed over a band of rows at a time, top to bottom,
+    // so the whole image never has to be in memory
+    class Encoder
+    {
+    public:
+        virtual ~Encoder() = default;
+
+        // Whether every band has to go through scan before the first add,
+        // for formats that pick their layout from the colours used
+        virtual bool needs_scan() const { return false; }
+        virtual void scan(const Image &band) {}
+
+        // Appends band to out, the header comes with the first one
+        virtual bool add(const Image &band, std::vector<Uint8> &out) = 0;
+        // Appends the end of the file once every row has been added
+        virtual bool finish(std::vector<Uint8> &out) = 0;
+    };
+
+    std::unique_ptr<Encoder> make_encoder(int w, int h, const Options &opts = g_options);
+
+    // File written a piece at a time, stdout if the path is "-"
+    class Output
+    {
+    public:
+        bool open(const std::string &path);
+        bool write(const std::vector<Uint8> &data);
+        // Returns false if any write failed
+        bool close();
+
+    private:
+        std::ofstream m_file;
+        bool m_stdout{ false };
+        bool m_ok{ true };
+    };
+
+    // Return false for names they don't know
+    bool parse_format(const std::string &name, Format &format);
+    bool parse_filter(const std::string &name, Filter &filter);
+    // Without the dot
+    const char *extension(Format format);
+
+    // Changes whenever opts would produce different bytes, part of cache keys
+    Uint64 fingerprint(const Options &opts = g_options);
+
+    // Encodes img with every format and a range of PNG settings and prints
+    // the size and time of each, next to SDL_image's PNG writer
+    void benchmark(const Image &img, std::ostream &out);
+}
@@ -0,0 +1,142 @@
+#include "hash.h"
+
+Uint64 hash::bytes(const void *data, size_t n, Uint64 h)
+{
+    const Uint8 *p = (const Uint8*)data;
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+Uint64 hash::string(const std::string &s, Uint64 h)
+{
+    // Length first so "ab", "c" and "a", "bc" differ
+    Uint64 n = s.size();
+    h = bytes(&n, sizeof(n), h);
+    return bytes(s.data(), s.size(), h);
+}
+
+Uint64 hash::combine(Uint64 h, Uint64 v)
+{
+    return bytes(&v, sizeof(v), h);
+}
+
+Uint64 hash::node(const Ast &ast, NodeId id, std::vector<Uint64> *subtrees)
+{
+    const Uint64 none = combine(g_offset, (Uint64)-1);
+    if (id == g_no_node)
+        return none;
+
+    std::vector<Uint64> local;
+    std::vector<Uint64> &hashes = subtrees ? *subtrees : local;
+    if (hashes.size() < ast.size())
+        hashes.resize(ast.size());
+
+    // Children come before their parents, so one pass in id order hashes
+    // every child before it is needed, however deep the tree is
+    for (NodeId i = 0; i <= id; ++i)
+    {
+        const Node &n = ast.node(i);
+        auto child = [&](uint32_t c) {
+            NodeId cid = ast.child(n, c);
+            return cid == g_no_node ? none : hashes[cid];
+        };
+
+        // A group of one is laid out exactly like its only element
+        if (n.type == NodeType::COMPOUND && n.count == 1 && ast.child(n, 0) != g_no_node)
+        {
+            hashes[i] = child(0);
+            continue;
+        }
+
+        Uint64 h = combine(g_offset, (Uint64)n.type);
+
+        // Names by value, interned indices differ from one parse to the next
+        if (n.type == NodeType::ID || n.type == NodeType::FN)
+            h = string(ast.name(n), h);
+
+        for (uint32_t c = 0; c < n.count; ++c)
+            h = combine(h, child(c));
+
+        hashes[i] = h;
+    }
+
+    return hashes[id];
+}
+
+std::string hash::canonical(const Ast &ast, NodeId id)
+{
+    if (id == g_no_node)
+        return "-";
+
+    // Children have smaller ids, so going down from id marks everything
+    // under it in one pass
+    std::vector<bool> under(id + 1, false);
+    under[id] = true;
+    for (NodeId i = id + 1; i-- > 0;)
+    {
+        if (!under[i])
+            continue;
+
+        const Node &n = ast.node(i);
+        for (uint32_t c = 0; c < n.count; ++c)
+        {
+            NodeId cid = ast.child(n, c);
+            if (cid != g_no_node)
+                under[cid] = true;
+        }
+    }
+
+    // Nodes are written bottom up and numbered in that order, children by
+    // their number. Groups of one are their element, like in node.
+    const uint32_t none = UINT32_MAX;
+    std::vector<uint32_t> number(id + 1, none);
+    uint32_t next = 0;
+    std::string s;
+
+    for (NodeId i = 0; i <= id; ++i)
+    {
+        if (!under[i])
+            continue;
+
+        const Node &n = ast.node(i);
+        if (n.type == NodeType::COMPOUND && n.count == 1 && ast.child(n, 0) != g_no_node)
+        {
+            number[i] = number[ast.child(n, 0)];
+            continue;
+        }
+
+        number[i] = next++;
+        s += std::to_string((int)n.type);
+        if (n.type == NodeType::ID || n.type == NodeType::FN)
+        {
+            const std::string &name = ast.name(n);
+            s += ":" + std::to_string(name.size()) + ":" + name;
+        }
+
+        for (uint32_t c = 0; c < n.count; ++c)
+        {
+            NodeId cid = ast.child(n, c);
+            s += cid == g_no_node ? " -" : " " + std::to_string(number[cid]);
+        }
+
+        s += ";";
+    }
+
+    return s;
+}
+
+std::string hash::hex(Uint64 h)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string s(16, '0');
+    for (int i = 15; i >= 0; --i, h >>= 4)
+        s[i] = digits[h & 15];
+
+    return s;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "node.h"
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+namespace hash
+{
+    // 64 bit FNV-1a
+    const Uint64 g_offset = 14695981039346656037ull;
+
+    Uint64 bytes(const void *data, size_t n, Uint64 h = g_offset);
+    Uint64 string(const std::string &s, Uint64 h = g_offset);
+    Uint64 combine(Uint64 h, Uint64 v);
+
+    // Structural hash of a subtree. Trees that are drawn the same way hash
+    // the same, {x} and x for example. The hash of every subtree on the way
+    // is stored in subtrees by node id if given. Takes time linear in id.
+    Uint64 node(const Ast &ast, NodeId id, std::vector<Uint64> *subtrees = nullptr);
+    // The subtree at id written out in full, the same for two trees exactly
+    // when node treats them as the same. For telling a real match of two
+    // hashes from a collision. Takes time linear in id.
+    std::string canonical(const Ast &ast, NodeId id);
+
+    std::string hex(Uint64 h);
+}
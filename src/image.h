@@ -0,0 +1,10 @@
+#pragma once
+#include <vector>
+#include <SDL2/SDL.h>
+
+// Rasterized formula, 4 bytes per pixel in RGBA order
+struct Image
+{
+    int w{ 0 }, h{ 0 };
+    std::vector<Uint8> pixels;
+};
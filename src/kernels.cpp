@@ -0,0 +1,257 @@
+#include "kernels.h"
+#include <atomic>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Plain C++, also finishes the pixels left over by the vector loops
+
+    void fill_c(Uint8 *dst, size_t n, Uint32 pixel)
+    {
+        for (size_t i = 0; i < n; ++i)
+            memcpy(dst + i * 4, &pixel, 4);
+    }
+
+    void over_c(Uint8 *dst, const Uint8 *src, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i, dst += 4, src += 4)
+        {
+            if (src[3] == 0)
+                continue;
+
+            for (int c = 0; c < 4; ++c)
+                dst[c] = src[c] + dst[c] * (255 - src[3]) / 255;
+        }
+    }
+
+    // Continues the running sums of prefix from pixel i, sums up to it are
+    // already written
+    void prefix_from(const Uint32 *src, size_t i, size_t n, Uint32 *sums)
+    {
+        Uint32 r = sums[i * 4], g = sums[i * 4 + 1], b = sums[i * 4 + 2], a = sums[i * 4 + 3];
+        for (; i < n; ++i)
+        {
+            Uint32 px = src[i];
+            Uint32 pa = px >> 24;
+            r += (px >> 16 & 255) * pa;
+            g += (px >> 8 & 255) * pa;
+            b += (px & 255) * pa;
+            a += pa;
+
+            Uint32 *s = sums + (i + 1) * 4;
+            s[0] = r;
+            s[1] = g;
+            s[2] = b;
+            s[3] = a;
+        }
+    }
+
+    void prefix_c(const Uint32 *src, size_t n, Uint32 *sums)
+    {
+        memset(sums, 0, 4 * sizeof(Uint32));
+        prefix_from(src, 0, n, sums);
+    }
+
+    void box_c(const Uint32 *sums, const int *x0, const int *x1, size_t n, Uint32 *acc)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+                acc[i * 4 + c] += sums[x1[i] * 4 + c] - sums[x0[i] * 4 + c];
+        }
+    }
+
+    const kernels::Set g_c = { "scalar", fill_c, over_c, prefix_c, box_c };
+
+#ifdef KERNELS_X86
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+    SSE2 void fill_sse2(Uint8 *dst, size_t n, Uint32 pixel)
+    {
+        __m128i v = _mm_set1_epi32(pixel);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+
+        fill_c(dst + i * 4, n - i, pixel);
+    }
+
+    // One half of over on 16 bit lanes: s + d * (255 - alpha of s) / 255,
+    // with x / 255 as (x + 1 + (x >> 8)) >> 8 which is exact up to 65534
+    SSE2 __m128i over_half(__m128i s, __m128i d)
+    {
+        const __m128i ff = _mm_set1_epi16(255), one = _mm_set1_epi16(1);
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+        __m128i x = _mm_mullo_epi16(d, _mm_sub_epi16(ff, a));
+        x = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+
+        // Wraps like the byte stores of over_c
+        return _mm_and_si128(_mm_add_epi16(s, x), ff);
+    }
+
+    SSE2 void over_sse2(Uint8 *dst, const Uint8 *src, size_t n)
+    {
+        const __m128i z = _mm_setzero_si128(), alpha = _mm_set1_epi32(0xff000000);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i * 4)),
+                d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+
+            __m128i r = _mm_packus_epi16(
+                over_half(_mm_unpacklo_epi8(s, z), _mm_unpacklo_epi8(d, z)),
+                over_half(_mm_unpackhi_epi8(s, z), _mm_unpackhi_epi8(d, z)));
+
+            __m128i skip = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), z);
+            r = _mm_or_si128(_mm_and_si128(skip, d), _mm_andnot_si128(skip, r));
+            _mm_storeu_si128((__m128i*)(dst + i * 4), r);
+        }
+
+        over_c(dst + i * 4, src + i * 4, n - i);
+    }
+
+    SSE2 void prefix_sse2(const Uint32 *src, size_t n, Uint32 *sums)
+    {
+        const __m128i z = _mm_setzero_si128(),
+            // Multiplies colour by alpha and alpha by 1
+            keep = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1),
+            one = _mm_set_epi16(1, 0, 0, 0, 1, 0, 0, 0);
+
+        __m128i sum = z;
+        _mm_storeu_si128((__m128i*)sums, sum);
+
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i halves[2] = { _mm_unpacklo_epi8(px, z), _mm_unpackhi_epi8(px, z) };
+
+            for (int h = 0; h < 2; ++h)
+            {
+                // BGRA in memory to RGBA
+                __m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 0, 1, 2)),
+                    _MM_SHUFFLE(3, 0, 1, 2));
+                __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+                v = _mm_mullo_epi16(v, _mm_or_si128(_mm_and_si128(a, keep), one));
+
+                Uint32 *s = sums + (i + h * 2 + 1) * 4;
+                sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(v, z));
+                _mm_storeu_si128((__m128i*)s, sum);
+                sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(v, z));
+                _mm_storeu_si128((__m128i*)(s + 4), sum);
+            }
+        }
+
+        prefix_from(src, i, n, sums);
+    }
+
+    SSE2 void box_sse2(const Uint32 *sums, const int *x0, const int *x1, size_t n, Uint32 *acc)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            __m128i s = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(sums + x1[i] * 4)),
+                _mm_loadu_si128((const __m128i*)(sums + x0[i] * 4)));
+            __m128i *a = (__m128i*)(acc + i * 4);
+            _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), s));
+        }
+    }
+
+    const kernels::Set g_sse2 = { "sse2", fill_sse2, over_sse2, prefix_sse2, box_sse2 };
+
+    AVX2 void fill_avx2(Uint8 *dst, size_t n, Uint32 pixel)
+    {
+        __m256i v = _mm256_set1_epi32(pixel);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_si256((__m256i*)(dst + i * 4), v);
+
+        fill_c(dst + i * 4, n - i, pixel);
+    }
+
+    AVX2 __m256i over_half(__m256i s, __m256i d)
+    {
+        const __m256i ff = _mm256_set1_epi16(255), one = _mm256_set1_epi16(1);
+        __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+        __m256i x = _mm256_mullo_epi16(d, _mm256_sub_epi16(ff, a));
+        x = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+        return _mm256_and_si256(_mm256_add_epi16(s, x), ff);
+    }
+
+    AVX2 void over_avx2(Uint8 *dst, const Uint8 *src, size_t n)
+    {
+        const __m256i z = _mm256_setzero_si256(), alpha = _mm256_set1_epi32(0xff000000);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i s = _mm256_loadu_si256((const __m256i*)(src + i * 4)),
+                d = _mm256_loadu_si256((const __m256i*)(dst + i * 4));
+
+            // Unpacking and packing both work within 128 bit lanes, so the
+            // pixels come back in order
+            __m256i r = _mm256_packus_epi16(
+                over_half(_mm256_unpacklo_epi8(s, z), _mm256_unpacklo_epi8(d, z)),
+                over_half(_mm256_unpackhi_epi8(s, z), _mm256_unpackhi_epi8(d, z)));
+
+            __m256i skip = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), z);
+            _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_blendv_epi8(r, d, skip));
+        }
+
+        over_sse2(dst + i * 4, src + i * 4, n - i);
+    }
+
+    // Running sums and box sums work on one pixel of 4 lanes at a time,
+    // wider versions of them measured slower on glyph sized rows
+    const kernels::Set g_avx2 = { "avx2", fill_avx2, over_avx2, prefix_sse2, box_sse2 };
+#endif
+
+    std::atomic<const kernels::Set*> g_set{ nullptr };
+}
+
+const std::vector<const kernels::Set*> &kernels::supported()
+{
+    static const std::vector<const Set*> sets = [] {
+        std::vector<const Set*> v = { &g_c };
+#ifdef KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            v.push_back(&g_sse2);
+        if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("avx2"))
+            v.push_back(&g_avx2);
+#endif
+        return v;
+    }();
+
+    return sets;
+}
+
+const kernels::Set &kernels::get()
+{
+    const Set *set = g_set.load(std::memory_order_acquire);
+    if (!set)
+    {
+        set = supported().back();
+        g_set.store(set, std::memory_order_release);
+    }
+
+    return *set;
+}
+
+bool kernels::use(const std::string &name)
+{
+    for (const Set *set : supported())
+    {
+        if (name == set->name)
+        {
+            g_set.store(set, std::memory_order_release);
+            return true;
+        }
+    }
+
+    return false;
+}
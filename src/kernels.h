@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <SDL2/SDL.h>
+
+// Pixel loops of the cpu backend in plain C++, SSE2 and AVX2. The fastest
+// set the processor supports is picked the first time one is used, and
+// every set gives exactly the same pixels.
+namespace kernels
+{
+    struct Set
+    {
+        const char *name;
+
+        // Sets n pixels to the 4 bytes of pixel as they are in memory
+        void (*fill)(Uint8 *dst, size_t n, Uint32 pixel);
+        // Composites n premultiplied RGBA pixels of src over dst, pixels of
+        // src without alpha are skipped
+        void (*over)(Uint8 *dst, const Uint8 *src, size_t n);
+        // Premultiplies n ARGB8888 pixels and writes their running sums to
+        // sums as 4 lanes per pixel in RGBA order, starting with a zero
+        // pixel, so the sum of pixels [a, b) is sums[4 * b] - sums[4 * a]
+        void (*prefix)(const Uint32 *src, size_t n, Uint32 *sums);
+        // Adds the sum of pixels [x0[i], x1[i]) of prefix sums to the 4 lanes
+        // of acc[i] for each of n columns
+        void (*box)(const Uint32 *sums, const int *x0, const int *x1, size_t n, Uint32 *acc);
+    };
+
+    // Every set the processor can run, plain C++ first and fastest last
+    const std::vector<const Set*> &supported();
+    // The set in use, the fastest unless another one was picked with use
+    const Set &get();
+    // Switches to the set called name, returns false if it isn't supported.
+    // No other thread may be drawing.
+    bool use(const std::string &name);
+}
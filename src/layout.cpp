@@ -0,0 +1,488 @@
+#include "layout.h"
+#include "atlas.h"
+#include "hash.h"
+#include "commands.h"
+#include "trace.h"
+#include "symbols.h"
+#include <stdexcept>
+#include <algorithm>
+#include <SDL2/SDL_ttf.h>
+
+extern TTF_Font *g_font;
+extern int g_font_size;
+extern Atlas g_atlas;
+
+layout::BoxId layout::Layout::build(const Ast &ast)
+{
+    m_boxes.clear();
+    m_children.clear();
+    m_entries.clear();
+    m_shared.clear();
+
+    lay_out(ast);
+    m_built = m_boxes.size();
+    return m_root;
+}
+
+layout::BoxId layout::Layout::update(const Ast &ast)
+{
+    if (m_boxes.size() > 2 * m_built + 4096)
+        return build(ast);
+
+    return lay_out(ast);
+}
+
+layout::BoxId layout::Layout::lay_out(const Ast &ast)
+{
+    trace::Scope scope("layout");
+    m_ast = &ast;
+    m_first_new = m_boxes.size();
+    m_hashes.clear();
+    m_hits = m_misses = 0;
+
+    hash::node(ast, ast.root(), &m_hashes);
+
+    // Children have smaller ids than their parents, so laying out in id
+    // order finds every argument already done and expr never recurses,
+    // however deeply the formula nests
+    m_items.assign(ast.root(), { g_no_box, 0, 0 });
+    m_entry_of.assign(ast.root(), SIZE_MAX);
+    for (NodeId i = 0; i < ast.root(); ++i)
+        m_items[i] = expr(*this, i);
+
+    const Node &root = ast.node(ast.root());
+    m_root = (root.type == NodeType::LINES ? lines(*this, root) : compound(*this, root)).box;
+    m_ast = nullptr;
+    m_items.clear();
+
+    // Subtrees that were dropped from the formula aren't looked for again
+    prune();
+    m_entry_of.clear();
+    return m_root;
+}
+
+const layout::Item *layout::Layout::laid_out(NodeId n) const
+{
+    if (n >= m_items.size() || m_items[n].box == g_no_box)
+        return nullptr;
+
+    return &m_items[n];
+}
+
+const layout::Item *layout::Layout::shared(NodeId n)
+{
+    const Node &node = m_ast->node(n);
+
+    // A group of one is laid out like its element, which came first
+    if (node.type == NodeType::COMPOUND && node.count == 1 && m_ast->child(node, 0) != g_no_node)
+    {
+        size_t e = m_entry_of[m_ast->child(node, 0)];
+        if (e == SIZE_MAX)
+        {
+            ++m_misses;
+            return nullptr;
+        }
+
+        ++m_hits;
+        m_entry_of[n] = e;
+        return &m_entries[e].item;
+    }
+
+    std::vector<size_t> children;
+    if (child_entries(node, children))
+    {
+        bool named = node.type == NodeType::ID || node.type == NodeType::FN;
+        auto [first, last] = m_shared.equal_range(m_hashes[n]);
+        for (auto it = first; it != last; ++it)
+        {
+            const Entry &e = m_entries[it->second];
+            if (e.type == node.type && e.children == children &&
+                (!named || e.name == m_ast->name(node)))
+            {
+                ++m_hits;
+                m_entry_of[n] = it->second;
+                return &e.item;
+            }
+        }
+    }
+
+    ++m_misses;
+    return nullptr;
+}
+
+void layout::Layout::share(NodeId n, const Item &item)
+{
+    const Node &node = m_ast->node(n);
+    if (node.type == NodeType::COMPOUND && node.count == 1 && m_ast->child(node, 0) != g_no_node)
+        return;
+
+    Entry e{ m_hashes[n], node.type, {}, {}, item };
+    if (!child_entries(node, e.children))
+        return;
+    if (node.type == NodeType::ID || node.type == NodeType::FN)
+        e.name = m_ast->name(node);
+
+    m_entry_of[n] = m_entries.size();
+    m_shared.emplace(e.hash, m_entries.size());
+    m_entries.emplace_back(std::move(e));
+}
+
+bool layout::Layout::child_entries(const Node &n, std::vector<size_t> &out) const
+{
+    out.clear();
+    for (uint32_t i = 0; i < n.count; ++i)
+    {
+        NodeId c = m_ast->child(n, i);
+        if (c != g_no_node && m_entry_of[c] == SIZE_MAX)
+            return false;
+
+        out.push_back(c == g_no_node ? SIZE_MAX : m_entry_of[c]);
+    }
+
+    return true;
+}
+
+void layout::Layout::prune()
+{
+    // Children of a kept entry are entries of the children of the node
+    // that matched it, so they're kept too, and they always come first
+    std::vector<size_t> renumber(m_entries.size(), SIZE_MAX);
+    for (size_t e : m_entry_of)
+    {
+        if (e != SIZE_MAX)
+            renumber[e] = 0;
+    }
+
+    std::vector<Entry> kept;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (renumber[i] == SIZE_MAX)
+            continue;
+
+        renumber[i] = kept.size();
+        kept.emplace_back(std::move(m_entries[i]));
+        for (size_t &c : kept.back().children)
+        {
+            if (c != SIZE_MAX)
+                c = renumber[c];
+        }
+    }
+
+    m_entries = std::move(kept);
+    m_shared.clear();
+    for (size_t i = 0; i < m_entries.size(); ++i)
+        m_shared.emplace(m_entries[i].hash, i);
+}
+
+layout::BoxId layout::Layout::add(Box b)
+{
+    m_boxes.emplace_back(std::move(b));
+    return m_boxes.size() - 1;
+}
+
+layout::BoxId layout::Layout::group(int w, int h, const std::vector<Placement> &children)
+{
+    Box b;
+    b.w = w;
+    b.h = h;
+    b.first = m_children.size();
+    b.count = children.size();
+    b.cost = 0;
+    for (const auto &c : children)
+        b.cost += m_boxes[c.box].cost;
+    m_children.insert(m_children.end(), children.begin(), children.end());
+    return add(std::move(b));
+}
+
+layout::Placement layout::place(const Item &item, int x, int y)
+{
+    return { item.box, { x, y, item.w, item.h } };
+}
+
+layout::Placement layout::rule(Layout &l, int x, int y, int w, int h)
+{
+    Box b;
+    b.type = BoxType::RULE;
+    return { l.add(std::move(b)), { x, y, w, h } };
+}
+
+layout::Placement layout::line(Layout &l, int x1, int y1, int x2, int y2)
+{
+    Box b;
+    b.type = BoxType::LINE;
+    return { l.add(std::move(b)), { x1, y1, x2 - x1, y2 - y1 } };
+}
+
+layout::Item layout::expr(Layout &l, NodeId expr)
+{
+    if (expr == g_no_node)
+        throw std::runtime_error("Missing argument");
+
+    if (const Item *item = l.laid_out(expr))
+        return *item;
+
+    if (const Item *item = l.shared(expr))
+        return *item;
+
+    const Node &n = l.ast().node(expr);
+    Item item;
+    switch (n.type)
+    {
+    case NodeType::FN: item = fn(l, n); break;
+    case NodeType::ID: item = text(l, l.ast().name(n)); break;
+    case NodeType::COMPOUND: item = compound(l, n); break;
+    case NodeType::LINES: item = lines(l, n); break;
+    case NodeType::NOOP: item = text(l, " "); break;
+    default: throw std::runtime_error("error in layout::expr");
+    }
+
+    l.share(expr, item);
+    return item;
+}
+
+layout::Item layout::compound(Layout &l, const Node &cpd)
+{
+    std::vector<Item> items;
+    for (uint32_t i = 0; i < cpd.count; ++i)
+        items.emplace_back(expr(l, l.ast().child(cpd, i)));
+
+    int w = 0,
+        h = 0;
+
+    for (const auto &it : items)
+    {
+        if (it.h > h)
+            h = it.h;
+
+        w += it.w + 10;
+    }
+
+    w -= 10;
+
+    std::vector<Placement> children;
+    int x = 0;
+    for (const auto &it : items)
+    {
+        children.emplace_back(place(it, x, h / 2 - it.h / 2));
+        x += it.w + 10;
+    }
+
+    return { l.group(w, h, children), w, h };
+}
+
+layout::Item layout::lines(Layout &l, const Node &lines)
+{
+    std::vector<Placement> children;
+    int w = 0,
+        y = 0;
+
+    for (uint32_t i = 0; i < lines.count; ++i)
+    {
+        Item it = expr(l, l.ast().child(lines, i));
+        children.emplace_back(place(it, 0, y));
+
+        w = std::max(w, it.w);
+        y += it.h + 10;
+    }
+
+    int h = std::max(0, y - 10);
+    return { l.group(w, h, children), w, h };
+}
+
+layout::Item layout::fn(Layout &l, const Node &fn)
+{
+    const std::string &name = l.ast().name(fn);
+    const commands::Command *cmd = commands::find(name);
+
+    if (!cmd)
+        throw std::runtime_error("Function '" + name + "' does not exist");
+
+    if (cmd->layout)
+    {
+        trace::Scope scope("layout ", name);
+        return cmd->layout(l, fn);
+    }
+
+    return text_unicode(l, std::u32string(1, cmd->codepoint));
+}
+
+layout::Item layout::text(Layout &l, std::string s)
+{
+    if (s.empty()) s = " ";
+
+    // Bytes are latin-1, same as TTF_RenderText
+    std::u32string run;
+    for (char c : s)
+        run += (char32_t)(unsigned char)c;
+
+    return text_unicode(l, run);
+}
+
+layout::Item layout::text_unicode(Layout &l, const std::u32string &s)
+{
+    Box b;
+    b.type = BoxType::TEXT;
+    b.size = g_font_size;
+    b.w = l.vector() ? metrics_run_width(g_font, b.size, s) : g_atlas.run_width(g_font, b.size, s);
+    b.h = TTF_FontHeight(g_font);
+    b.text = s;
+    b.cost = s.size();
+
+    int w = b.w, h = b.h;
+    return { l.add(std::move(b)), w, h };
+}
+
+layout::Item layout::shape(Layout &l, path::Path p, int w, int h)
+{
+    Box b;
+    b.type = BoxType::PATH;
+    b.w = w;
+    b.h = h;
+    b.path = std::move(p);
+    b.cost = b.path.outlines().size();
+
+    return { l.add(std::move(b)), w, h };
+}
+
+layout::Item layout::functions::frac(Layout &l, const Node &fn)
+{
+    Item top = expr(l, l.ast().child(fn, 0));
+    Item bot = expr(l, l.ast().child(fn, 1));
+    top.resize(.5f);
+    bot.resize(.5f);
+
+    int w = std::max(top.w, bot.w);
+    int h = top.h + bot.h + 5;
+
+    return { l.group(w, h, {
+        place(top, (w - top.w) / 2, 0),
+        place(bot, (w - bot.w) / 2, top.h + 5),
+        rule(l, 0, top.h + 2, w, 2)
+    }), w, h };
+}
+
+layout::Item layout::functions::sum(Layout &l, const Node &fn)
+{
+    Item sigma = shape(l, symbols::sigma(70, 70), 70, 70);
+    Item bot = expr(l, l.ast().child(fn, 0));
+    Item top = expr(l, l.ast().child(fn, 1));
+    bot.resize(.5f);
+    top.resize(.5f);
+
+    int maxw = std::max(70, std::max(top.w, bot.w));
+    int w = std::max(sigma.w, std::max(bot.w, top.w));
+    int h = sigma.h + bot.h + top.h;
+
+    return { l.group(w, h, {
+        place(sigma, maxw / 2 - 70 / 2, top.h),
+        place(top, maxw / 2 - top.w / 2, 0),
+        place(bot, maxw / 2 - bot.w / 2, top.h + sigma.h)
+    }), w, h };
+}
+
+layout::Item layout::functions::integral(Layout &l, const Node &fn)
+{
+    return shape(l, symbols::integral(20, 140), 20, 140);
+}
+
+layout::Item layout::functions::ointegral(Layout &l, const Node &fn)
+{
+    return shape(l, symbols::ointegral(20, 140), 20, 140);
+}
+
+layout::Item layout::functions::lim(Layout &l, const Node &fn)
+{
+    Item lim = text(l, "lim");
+    Item bot = expr(l, l.ast().child(fn, 0));
+    lim.resize(.6f);
+    bot.resize(.4f);
+
+    int w = std::max(lim.w, bot.w);
+    int h = lim.h + bot.h;
+
+    return { l.group(w, h, {
+        place(bot, lim.w < bot.w ? 0 : lim.w / 2 - bot.w / 2, lim.h - bot.h / 2),
+        place(lim, lim.w < bot.w ? bot.w / 2 - lim.w / 2 : 0, 0)
+    }), w, h };
+}
+
+layout::Item layout::functions::vec(Layout &l, const Node &fn)
+{
+    Item term = expr(l, l.ast().child(fn, 0));
+    int w = term.w;
+
+    return { l.group(term.w, term.h, {
+        place(term, 0, 0),
+        place(shape(l, symbols::arrow(w, 10), w, 10), 0, 0)
+    }), term.w, term.h };
+}
+
+layout::Item layout::functions::sqrt(Layout &l, const Node &fn)
+{
+    Item term = expr(l, l.ast().child(fn, 0));
+    int w = term.w + 10;
+    int h = term.h;
+
+    return { l.group(w, h, {
+        place(term, 10, 0),
+        place(shape(l, symbols::radical(w, h, 10), w, h), 0, 0)
+    }), w, h };
+}
+
+layout::Item layout::functions::paren(Layout &l, const Node &fn)
+{
+    Item term = expr(l, l.ast().child(fn, 0));
+    int d = std::clamp(term.h / 6, 8, 20);
+    int w = term.w + 2 * d;
+    int h = term.h;
+
+    return { l.group(w, h, {
+        place(shape(l, symbols::paren(d, h, false), d, h), 0, 0),
+        place(term, d, 0),
+        place(shape(l, symbols::paren(d, h, true), d, h), d + term.w, 0)
+    }), w, h };
+}
+
+layout::Item layout::functions::bracket(Layout &l, const Node &fn)
+{
+    Item term = expr(l, l.ast().child(fn, 0));
+    int d = std::clamp(term.h / 8, 6, 16);
+    int w = term.w + 2 * d;
+    int h = term.h;
+
+    return { l.group(w, h, {
+        place(shape(l, symbols::bracket(d, h, false), d, h), 0, 0),
+        place(term, d, 0),
+        place(shape(l, symbols::bracket(d, h, true), d, h), d + term.w, 0)
+    }), w, h };
+}
+
+layout::Item layout::functions::exponent(Layout &l, const Node &fn)
+{
+    Item base = expr(l, l.ast().child(fn, 0));
+    Item exp = expr(l, l.ast().child(fn, 1));
+
+    exp.resize(.5f);
+    int w = base.w + exp.w;
+    int h = base.h;
+
+    return { l.group(w, h, {
+        place(base, 0, 0),
+        place(exp, base.w, 0)
+    }), w, h };
+}
+
+layout::Item layout::functions::subscript(Layout &l, const Node &fn)
+{
+    Item base = expr(l, l.ast().child(fn, 0));
+    Item sub = expr(l, l.ast().child(fn, 1));
+
+    sub.resize(.5f);
+    int w = base.w + sub.w;
+    int h = base.h;
+
+    return { l.group(w, h, {
+        place(base, 0, 0),
+        place(sub, base.w, base.h - sub.h)
+    }), w, h };
+}
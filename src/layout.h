@@ -0,0 +1,183 @@
+#pragma once
+#include "node.h"
+#include "path.h"
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace layout
+{
+    using BoxId = size_t;
+
+    const BoxId g_no_box = SIZE_MAX;
+
+    enum class BoxType
+    {
+        GROUP,
+        TEXT,
+        PATH,
+        RULE,
+        LINE
+    };
+
+    struct Box
+    {
+        BoxType type{ BoxType::GROUP };
+
+        // Natural size, children are placed in this coordinate space
+        int w{ 0 }, h{ 0 };
+
+        // Glyphs and strokes in the whole subtree, a rough rasterization cost
+        size_t cost{ 1 };
+
+        // TEXT, run of codepoints drawn from the glyph atlas
+        std::u32string text;
+        int size{ 0 };
+
+        // PATH, outlines in the box's own units
+        path::Path path;
+
+        // GROUP, range in Layout::m_children
+        size_t first{ 0 }, count{ 0 };
+    };
+
+    // Where a child box goes inside its parent, in parent units. The child is
+    // stretched from its natural size to fill the rect. RULE fills the rect,
+    // LINE runs from (x, y) to (x + w, y + h).
+    struct Placement
+    {
+        BoxId box;
+        SDL_Rect rect;
+    };
+
+    // Box as seen by its parent, the size can be scaled before placing
+    struct Item
+    {
+        BoxId box;
+        int w, h;
+
+        void resize(float s)
+        {
+            w *= s;
+            h *= s;
+        }
+    };
+
+    // Boxes form a DAG rather than a tree, a subtree that shows up more
+    // than once in a formula is laid out once and placed wherever it's used.
+    class Layout
+    {
+    public:
+        // Text in a vector layout is measured from the font alone, its
+        // glyphs are never rasterized into the atlas
+        explicit Layout(bool vector = false)
+            : m_vector(vector)
+        {
+        }
+
+        BoxId build(const Ast &ast);
+        // Same as build, but keeps the boxes from earlier builds and only
+        // lays out subtrees that haven't been seen before. Boxes that are no
+        // longer used pile up until they outnumber the rest, then the layout
+        // starts over from scratch.
+        BoxId update(const Ast &ast);
+        // Boxes below this id were reused from an earlier build
+        BoxId first_new() const { return m_first_new; }
+
+        bool vector() const { return m_vector; }
+
+        // Tree being laid out, only valid during build
+        const Ast &ast() const { return *m_ast; }
+
+        BoxId root() const { return m_root; }
+        const Box &box(BoxId id) const { return m_boxes[id]; }
+        const Placement *children(const Box &b) const { return m_children.data() + b.first; }
+
+        BoxId add(Box b);
+        BoxId group(int w, int h, const std::vector<Placement> &children);
+
+        // Returns the item already laid out for node n in this build, or
+        // nullptr if it hasn't been yet
+        const Item *laid_out(NodeId n) const;
+
+        // Returns the item laid out for an identical subtree earlier in this
+        // build or the one before, or nullptr if n is the first of its kind.
+        // Subtrees are compared in full, equal hashes aren't enough.
+        const Item *shared(NodeId n);
+        void share(NodeId n, const Item &item);
+
+        // Subtrees that reused an earlier layout, and ones laid out from scratch
+        size_t shared_hits() const { return m_hits; }
+        size_t shared_misses() const { return m_misses; }
+
+    private:
+        // A subtree laid out before. Its children are entries as well, so
+        // two subtrees are the same exactly when their roots match and their
+        // children have the same entries.
+        struct Entry
+        {
+            Uint64 hash;
+            NodeType type;
+            std::string name;
+            std::vector<size_t> children;
+            Item item;
+        };
+
+        BoxId lay_out(const Ast &ast);
+        // Entries of the children of n, false if one of them has none
+        bool child_entries(const Node &n, std::vector<size_t> &out) const;
+        // Drops the entries no node of the last build matched
+        void prune();
+
+    private:
+        bool m_vector{ false };
+        std::vector<Box> m_boxes;
+        std::vector<Placement> m_children;
+        BoxId m_root{ 0 };
+        BoxId m_first_new{ 0 };
+        // Boxes right after the last build from scratch
+        size_t m_built{ 0 };
+
+        const Ast *m_ast{ nullptr };
+        std::vector<Uint64> m_hashes;
+        // By node id, the box is g_no_box until the node is laid out
+        std::vector<Item> m_items;
+        std::vector<Entry> m_entries;
+        // Entries by hash
+        std::unordered_multimap<Uint64, size_t> m_shared;
+        // By node id, the entry the node matched, SIZE_MAX until it's laid out
+        std::vector<size_t> m_entry_of;
+        size_t m_hits{ 0 }, m_misses{ 0 };
+    };
+
+    Placement place(const Item &item, int x, int y);
+    Placement rule(Layout &l, int x, int y, int w, int h);
+    Placement line(Layout &l, int x1, int y1, int x2, int y2);
+
+    Item expr(Layout &l, NodeId expr);
+    Item compound(Layout &l, const Node &cpd);
+    // Rows stacked top to bottom, left aligned
+    Item lines(Layout &l, const Node &lines);
+    Item fn(Layout &l, const Node &fn);
+    Item text(Layout &l, std::string s);
+    Item text_unicode(Layout &l, const std::u32string &s);
+    // Outlines filled in black, p fits a box of w by h
+    Item shape(Layout &l, path::Path p, int w, int h);
+
+    namespace functions
+    {
+        Item frac(Layout &l, const Node &fn);
+        Item sum(Layout &l, const Node &fn);
+        Item integral(Layout &l, const Node &fn);
+        Item ointegral(Layout &l, const Node &fn);
+        Item lim(Layout &l, const Node &fn);
+        Item vec(Layout &l, const Node &fn);
+        Item sqrt(Layout &l, const Node &fn);
+        Item paren(Layout &l, const Node &fn);
+        Item bracket(Layout &l, const Node &fn);
+
+        Item exponent(Layout &l, const Node &fn);
+        Item subscript(Layout &l, const Node &fn);
+    }
+}
@@ -1,13 +1,51 @@
 #include "lexer.h"
-#include <vector>
-#include <algorithm>
+#include <array>
+#include <string>
+#include <stdexcept>
 
-static std::vector<char> g_reserved = { '{', '}', '\n', '\\', '^', '_', ' ' };
+namespace
+{
+    enum CharClass : unsigned char
+    {
+        // Ends an id: { } \n \ ^ _ space and NUL, which is never part of
+        // a formula
+        RESERVED = 1,
+        // Skipped between tokens, every isspace character but \n
+        SPACE = 2,
+        // Makes up a function name, isalpha in the C locale
+        ALPHA = 4
+    };
+
+    constexpr std::array<unsigned char, 256> make_classes()
+    {
+        std::array<unsigned char, 256> t{};
+
+        for (unsigned char c : { '{', '}', '\n', '\\', '^', '_', ' ', '\0' })
+            t[c] |= RESERVED;
+
+        for (unsigned char c : { ' ', '\t', '\v', '\f', '\r' })
+            t[c] |= SPACE;
+
+        for (int c = 'a'; c <= 'z'; ++c)
+            t[c] |= ALPHA;
+        for (int c = 'A'; c <= 'Z'; ++c)
+            t[c] |= ALPHA;
+
+        return t;
+    }
+
+    constexpr std::array<unsigned char, 256> g_classes = make_classes();
+
+    inline bool is(char c, CharClass cls)
+    {
+        return g_classes[(unsigned char)c] & cls;
+    }
+}
 
-Lexer::Lexer(const std::string &prog)
+Lexer::Lexer(std::string_view prog)
     : m_contents(prog)
 {
-    m_ch = m_contents[0];
+    m_ch = m_contents.empty() ? '\0' : m_contents[0];
 }
 
 Lexer::~Lexer()
@@ -16,46 +54,79 @@ Lexer::~Lexer()
 
 Token Lexer::next_tok()
 {
-    while (std::isspace(m_ch) && m_ch != '\n')
-        advance();
+    skip([](char c) { return is(c, SPACE); });
 
-    if (m_idx == m_contents.size() - 1)
-        return Token(TokenType::EOF_, "");
+    size_t line = m_line, col = m_col;
+    if (m_idx + 1 >= m_contents.size())
+        return Token(TokenType::EOF_, {}, line, col);
 
     switch (m_ch)
     {
-    case '{': advance(); return Token(TokenType::LBRACKET, "{");
-    case '}': advance(); return Token(TokenType::RBRACKET, "}");
-    case '\\': advance(); return Token(TokenType::FN, collect_alpha());
-    case '^': advance(); return Token(TokenType::INFIX_FN, "^");
-    case '_': advance(); return Token(TokenType::INFIX_FN, "_");
-    case '\n': advance(); return Token(TokenType::NEWLINE, "\n");
+    case '{': advance(); return Token(TokenType::LBRACKET, "{", line, col);
+    case '}': advance(); return Token(TokenType::RBRACKET, "}", line, col);
+    case '\\': advance(); return Token(TokenType::FN, collect_alpha(), line, col);
+    case '^': advance(); return Token(TokenType::INFIX_FN, "^", line, col);
+    case '_': advance(); return Token(TokenType::INFIX_FN, "_", line, col);
+    case '\n': advance(); return Token(TokenType::NEWLINE, "\n", line, col);
     }
 
-    return Token(TokenType::ID, collect_id());
+    // Every token has to consume something, or the parser would get the
+    // same one forever
+    std::string_view id = collect_id();
+    if (id.empty())
+    {
+        throw std::runtime_error(
+            "Unexpected character " + std::to_string((unsigned char)m_ch) + " on line " +
+            std::to_string(line) + ", column " + std::to_string(col));
+    }
+
+    return Token(TokenType::ID, id, line, col);
 }
 
 void Lexer::advance()
 {
-    if (m_idx < m_contents.size())
-        m_ch = m_contents[++m_idx];
+    if (m_idx >= m_contents.size())
+        return;
+
+    if (m_ch == '\n')
+    {
+        ++m_line;
+        m_col = 1;
+    }
+    else
+    {
+        ++m_col;
+    }
+
+    ++m_idx;
+    m_ch = m_idx < m_contents.size() ? m_contents[m_idx] : '\0';
 }
 
-std::string Lexer::collect_id()
+// Advances while pred holds, pred must not accept a newline
+template <typename F>
+void Lexer::skip(F pred)
 {
-    size_t begin = m_idx;
-    while (std::find(g_reserved.begin(), g_reserved.end(), m_ch) == g_reserved.end())
-        advance();
+    const char *p = m_contents.data();
+    size_t i = m_idx, n = m_contents.size();
 
-    return m_contents.substr(begin, m_idx - begin);
+    while (i < n && pred(p[i]))
+        ++i;
+
+    m_col += i - m_idx;
+    m_idx = i;
+    m_ch = i < n ? p[i] : '\0';
 }
 
-std::string Lexer::collect_alpha()
+std::string_view Lexer::collect_id()
 {
     size_t begin = m_idx;
-    while (std::isalpha(m_ch))
-        advance();
-
+    skip([](char c) { return !is(c, RESERVED); });
     return m_contents.substr(begin, m_idx - begin);
 }
 
+std::string_view Lexer::collect_alpha()
+{
+    size_t begin = m_idx;
+    skip([](char c) { return is(c, ALPHA); });
+    return m_contents.substr(begin, m_idx - begin);
+}
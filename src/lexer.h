@@ -1,22 +1,27 @@
 #pragma once
 #include "token.h"
 
+// Splits a formula into tokens without copying it. prog is borrowed and
+// must outlive the lexer and every token it returns. The last character of
+// prog is expected to be the terminating newline and is never tokenized.
 class Lexer
 {
 public:
-    Lexer(const std::string &prog);
+    Lexer(std::string_view prog);
     ~Lexer();
 
+    // Throws std::runtime_error on a character no token can start with
     Token next_tok();
 
 private:
     void advance();
-    std::string collect_id();
-    std::string collect_alpha();
+    template <typename F>
+    void skip(F pred);
+    std::string_view collect_id();
+    std::string_view collect_alpha();
 
 private:
-    std::string m_contents;
+    std::string_view m_contents;
     char m_ch{ 0 };
-    size_t m_idx{ 0 }, m_line{ 1 };
+    size_t m_idx{ 0 }, m_line{ 1 }, m_col{ 1 };
 };
-
@@ -1,22 +1,38 @@
 #include "parser.h"
 #include "draw.h"
+#include "batch.h"
+#include "server.h"
+#include "cache.h"
+#include "commands.h"
+#include "encode.h"
+#include "trace.h"
+#include "pool.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
 #endif
 
 bool g_ask_filename = true;
+// Where --stats and --trace write to, empty if not asked for
+std::string g_stats_path, g_trace_path;
+// Set by -o, skips asking for a filename. "-" writes to stdout.
+std::string g_out;
+std::unique_ptr<cache::Cache> g_cache;
 
 void run(const std::string &s)
 {
-    std::unique_ptr<Node> root;
+    Ast ast;
 
     try
     {
         Parser p(s);
-        root = p.parse();
+        ast = p.parse();
     }
     catch (const std::runtime_error &e)
     {
@@ -24,7 +40,80 @@ void run(const std::string &s)
         exit(EXIT_FAILURE);
     }
 
-    draw::draw(root.get(), g_ask_filename);
+    std::string fallback = std::string("out.") + draw::extension();
+    std::string out = g_out.empty() ? fallback : g_out;
+#ifndef __EMSCRIPTEN__
+    if (g_ask_filename && g_out.empty())
+    {
+        std::cout << "Save file as [default: " << fallback << "]: ";
+        std::getline(std::cin, out);
+
+        if (out.empty())
+            out = fallback;
+    }
+#endif
+
+    // Entries are copied by path, which stdout doesn't have
+    bool cached = g_cache && out != "-";
+
+    cache::Key key;
+    if (cached)
+    {
+        key = g_cache->key(ast);
+        if (g_cache->fetch(key, out))
+            return;
+    }
+
+    try
+    {
+        draw::draw(ast, out);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << "Error drawing: " << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if (cached)
+        g_cache->store(key, out);
+}
+
+// Writes what trace recorded, once everything is done
+void report()
+{
+    if (!g_stats_path.empty())
+    {
+        if (g_stats_path == "-")
+            trace::write_stats(std::cerr);
+        else
+        {
+            std::ofstream ofs(g_stats_path);
+            trace::write_stats(ofs);
+            if (!ofs)
+                std::cerr << "Couldn't write '" << g_stats_path << "'.\n";
+        }
+    }
+
+    if (!g_trace_path.empty() && !trace::write_trace(g_trace_path))
+        std::cerr << "Couldn't write '" << g_trace_path << "'.\n";
+}
+
+// Value of a numeric flag, exits with an error if it isn't a whole number
+// from min to max
+unsigned long long number(const char *flag, const char *value, unsigned long long min,
+    unsigned long long max)
+{
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (!isdigit((unsigned char)*value) || *end || errno == ERANGE || n < min || n > max)
+    {
+        std::cerr << flag << " expects a whole number from " << min << " to " << max
+                  << ", got '" << value << "'.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    return n;
 }
 
 void interactive()
@@ -33,7 +122,8 @@ void interactive()
     std::string line = emscripten_run_script_string("prompt('Input formula:');");
     std::cout << line << "\n";
 #else
-    std::cout << "Input: ";
+    // Keeps the prompt out of an image written to stdout
+    (g_out == "-" ? std::cerr : std::cout) << "Input: ";
     std::string line;
     std::getline(std::cin, line);
 #endif
@@ -43,22 +133,178 @@ void interactive()
 
 int main(int argc, char **argv)
 {
-    draw::init();
-#ifdef __EMSCRIPTEN__
-    emscripten_set_main_loop(interactive, -1, 1);
-#endif
+    std::string path;
+    std::string backend;
+    batch::Options batch_opts;
+    size_t threads = 0;
+    server::Options server_opts;
+    cache::Options cache_opts;
+    std::string symbols;
+    bool encode_bench = false;
 
-    if (argc >= 3)
+    for (int i = 1; i < argc; ++i)
     {
-        if (strcmp(argv[2], "-y") == 0)
+        if (strcmp(argv[i], "-y") == 0)
             g_ask_filename = false;
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            backend = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_opts.input = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            batch_opts.out_dir = server_opts.out_dir = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            batch_opts.stream = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            server_opts.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc)
+            server_opts.max_clients = number("--max-clients", argv[++i], 1, 1 << 16);
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_opts.dir = argv[++i];
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+            cache_opts.max_bytes = number("--cache-size", argv[++i], 1, 1ull << 40) << 20;
+        else if (strcmp(argv[i], "--cache-age") == 0 && i + 1 < argc)
+            cache_opts.max_age_days = number("--cache-age", argv[++i], 1, 100000);
+        else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc)
+            symbols = argv[++i];
+        else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i + 1 < argc)
+            g_out = argv[++i];
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            if (!encode::parse_format(argv[++i], encode::g_options.format))
+            {
+                std::cerr << "Unknown format '" << argv[i] << "', expected png, qoi, ppm or pgm.\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+            encode::g_options.level = number("--level", argv[++i], 0, 9);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            if (!encode::parse_filter(argv[++i], encode::g_options.filter))
+            {
+                std::cerr << "Unknown filter '" << argv[i] << "', expected none, sub, up, average, paeth or adaptive.\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--no-reduce") == 0)
+            encode::g_options.reduce = false;
+        else if (strcmp(argv[i], "--encode-bench") == 0)
+            encode_bench = true;
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            g_stats_path = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            g_trace_path = argv[++i];
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+            pool::g_budget = number("--texture-budget", argv[++i], 0, 1ull << 40) << 20;
+        else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc)
+            g_max_depth = number("--max-depth", argv[++i], 1, 1ull << 32);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = number("--threads", argv[++i], 0, 1024);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            batch_opts.jobs = number("--jobs", argv[++i], 0, 1024);
+        else
+            path = argv[i];
     }
 
-    if (argc == 1)
+    if (!symbols.empty() && !commands::load(symbols))
+        return EXIT_FAILURE;
+
+    if (!g_stats_path.empty() || !g_trace_path.empty())
+        trace::enable();
+
+    if (encode_bench)
+    {
+        if (path.empty())
+        {
+            std::cerr << "--encode-bench needs a file to render.\n";
+            return EXIT_FAILURE;
+        }
+
+        std::ifstream ifs(path);
+        std::stringstream ss;
+        std::string buf;
+
+        while (std::getline(ifs, buf))
+            ss << buf << "\n";
+
+        draw::init("cpu");
+        try
+        {
+            std::string src = ss.str();
+            Parser p(src);
+            Ast ast = p.parse();
+
+            std::unique_ptr<draw::Backend> be = draw::make_cpu_backend();
+            encode::benchmark(draw::render(*be, ast), std::cout);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            draw::quit();
+            return EXIT_FAILURE;
+        }
+
+        draw::quit();
+        return 0;
+    }
+
+    if (!batch_opts.input.empty() || !server_opts.socket_path.empty())
+    {
+        // Workers draw in parallel, which the sdl backend can't do
+        if (backend.empty())
+            backend = "cpu";
+
+        if (backend == "sdl" || (!server_opts.socket_path.empty() && backend != "cpu"))
+        {
+            std::cerr << "Batch mode only supports the cpu and svg backends, server mode only cpu.\n";
+            return EXIT_FAILURE;
+        }
+
+        draw::init(backend);
+        if (!cache_opts.dir.empty())
+            g_cache = std::make_unique<cache::Cache>(cache_opts, backend);
+
+        int rc = 0;
+        if (!server_opts.socket_path.empty())
+            rc = server::run(server_opts, g_cache.get());
+        else
+        {
+            batch_opts.backend = backend;
+            batch_opts.cache = g_cache.get();
+            rc = batch::run(batch_opts) ? 0 : EXIT_FAILURE;
+        }
+
+        if (g_cache)
+            g_cache->evict();
+        draw::quit();
+        report();
+
+        return rc;
+    }
+
+    // The SDL renderer is only needed to show something on screen, files are
+    // rendered headless
+    if (backend.empty())
+    {
+#ifdef __EMSCRIPTEN__
+        backend = "sdl";
+#else
+        backend = path.empty() ? "sdl" : "cpu";
+#endif
+    }
+
+    draw::init(backend, threads);
+    if (!cache_opts.dir.empty())
+        g_cache = std::make_unique<cache::Cache>(cache_opts, backend);
+#ifdef __EMSCRIPTEN__
+    emscripten_set_main_loop(interactive, -1, 1);
+#endif
+
+    if (path.empty())
         interactive();
     else
     {
-        std::ifstream ifs(argv[1]);
+        std::ifstream ifs(path);
         std::stringstream ss;
         std::string buf;
 
@@ -68,8 +314,10 @@ int main(int argc, char **argv)
         run(ss.str());
     }
 
+    if (g_cache)
+        g_cache->evict();
     draw::quit();
+    report();
 
     return 0;
 }
-
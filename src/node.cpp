@@ -0,0 +1,35 @@
+#include "node.h"
+
+NodeId Ast::add(NodeType type, std::string_view name)
+{
+    Node n;
+    n.type = type;
+
+    auto it = m_name_ids.find(name);
+    if (it == m_name_ids.end())
+    {
+        m_names.emplace_back(name);
+        it = m_name_ids.emplace(m_names.back(), m_names.size() - 1).first;
+    }
+    n.name = it->second;
+
+    m_nodes.emplace_back(n);
+    return m_nodes.size() - 1;
+}
+
+void Ast::set_children(NodeId id, const NodeId *children, size_t count)
+{
+    Node &n = m_nodes[id];
+    n.first = m_children.size();
+    n.count = count;
+    m_children.insert(m_children.end(), children, children + count);
+}
+
+size_t Ast::memory() const
+{
+    size_t bytes = m_nodes.capacity() * sizeof(Node) + m_children.capacity() * sizeof(NodeId);
+    for (const auto &s : m_names)
+        bytes += sizeof(s) + s.capacity();
+
+    return bytes;
+}
@@ -1,32 +1,77 @@
 #pragma once
+#include <deque>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
+#include <cstdint>
+#include <unordered_map>
 
 enum class NodeType
 {
     ID,
     FN,
     COMPOUND,
+    // Rows of a multi-line formula, each a COMPOUND
+    LINES,
     NOOP
 };
 
+using NodeId = uint32_t;
+
+// Stands in for an argument the parser found nothing for
+const NodeId g_no_node = UINT32_MAX;
+
 struct Node
 {
     NodeType type{ NodeType::NOOP };
 
-    Node() = default;
-    Node(NodeType type)
-        : type(type) {}
+    // ID text or function name, index into Ast's interned names
+    uint32_t name{ 0 };
+
+    // Function arguments or compound elements, range in Ast::m_children
+    uint32_t first{ 0 }, count{ 0 };
+};
 
-    // ID
-    std::string id;
+// Whole parse tree in a few flat arrays. Children refer to each other by
+// index and every id and function name is stored once, so dropping the Ast
+// frees the tree in one go. Children are always added before their parent,
+// so walking ids in ascending order visits a tree bottom up without
+// recursing.
+class Ast
+{
+public:
+    Ast() = default;
+    // Moves only, a copy would leave the interning table pointing at the
+    // original's names
+    Ast(Ast&&) = default;
+    Ast &operator=(Ast&&) = default;
+    Ast(const Ast&) = delete;
+    Ast &operator=(const Ast&) = delete;
 
-    // Function
-    std::string fn_name;
-    std::vector<std::unique_ptr<Node>> fn_args;
+    NodeId add(NodeType type, std::string_view name = {});
+    // Children of a node are kept next to each other, so they are all set
+    // at once after they have been parsed
+    void set_children(NodeId id, const NodeId *children, size_t count);
 
-    // Compound
-    std::vector<std::unique_ptr<Node>> comp_values;
-};
+    const Node &node(NodeId id) const { return m_nodes[id]; }
+    const std::string &name(const Node &n) const { return m_names[n.name]; }
+    const NodeId *children(const Node &n) const { return m_children.data() + n.first; }
+    NodeId child(const Node &n, size_t i) const { return m_children[n.first + i]; }
 
+    NodeId root() const { return m_root; }
+    void set_root(NodeId id) { m_root = id; }
+
+    size_t size() const { return m_nodes.size(); }
+    // Bytes held by the arrays, not counting the interning table
+    size_t memory() const;
+
+private:
+    std::vector<Node> m_nodes;
+    std::vector<NodeId> m_children;
+
+    // A deque so the views in m_name_ids stay valid as names are added
+    std::deque<std::string> m_names;
+    std::unordered_map<std::string_view, uint32_t> m_name_ids;
+
+    NodeId m_root{ g_no_node };
+};
@@ -1,19 +1,12 @@
 #include "parser.h"
+#include "commands.h"
+#include "trace.h"
 #include <stdexcept>
-#include <unordered_map>
-
-static std::unordered_map<std::string, size_t> g_fn_param_nums = {
-    { "frac", 2 },
-    { "_", 2 },
-    { "^", 2 },
-    { "sum", 2 },
-    { "vec", 1 },
-    { "sqrt", 1},
-    { "lim", 1 }
-};
-
-Parser::Parser(const std::string &prog)
-    : m_lexer(prog)
+
+size_t g_max_depth = 2000;
+
+Parser::Parser(std::string_view prog, size_t max_depth)
+    : m_lexer(prog), m_max_depth(max_depth)
 {
     m_curr = m_lexer.next_tok();
 }
@@ -22,27 +15,176 @@ Parser::~Parser()
 {
 }
 
-std::unique_ptr<Node> Parser::parse()
+Ast Parser::parse()
 {
-    std::unique_ptr<Node> comp = std::make_unique<Node>(NodeType::COMPOUND);
-    comp->comp_values.emplace_back(parse_expr());
+    trace::Scope scope("parse");
 
-    if (comp->comp_values[0])
+    // What the loop does next, in place of where a recursive parser would
+    // be in its call stack
+    enum class Step
+    {
+        // Start an expression
+        EXPR,
+        // A primary was parsed into n, it may be the left side of ^ or _
+        PRIMARY,
+        // An expression was parsed into n, give it to the top frame
+        RESULT,
+        // Inside { }, close it or start the next element
+        GROUP
+    } step = Step::EXPR;
+
+    NodeId n = g_no_node;
+    m_frames.push_back({ Frame::TOP, {}, 0, 0, m_curr.line, m_curr.col });
+
+    while (!m_frames.empty())
     {
-        while (true)
+        switch (step)
         {
-            std::unique_ptr<Node> expr = parse_expr();
-            if (!expr) break;
-
-            comp->comp_values.emplace_back(std::move(expr));
+        case Step::EXPR:
+            // Newlines outside of every group and argument end a row, inside
+            // them they are only spaces
+            while (m_curr.type == TokenType::NEWLINE)
+            {
+                expect(TokenType::NEWLINE);
+                if (m_frames.back().type == Frame::TOP)
+                    end_row();
+            }
+
+            step = Step::PRIMARY;
+
+            switch (m_curr.type)
+            {
+            case TokenType::FN:
+            {
+                // Unknown commands are reported by layout
+                const commands::Command *cmd = commands::find(m_curr.value);
+                size_t nparams = cmd ? cmd->arity : 0;
+
+                if (nparams)
+                {
+                    push(Frame::FN, m_curr.value, nparams);
+                    step = Step::EXPR;
+                }
+                else
+                {
+                    n = m_ast.add(NodeType::FN, m_curr.value);
+                }
+
+                expect(TokenType::FN);
+            } break;
+            case TokenType::ID:
+                n = m_ast.add(NodeType::ID, m_curr.value);
+                expect(TokenType::ID);
+                break;
+            case TokenType::LBRACKET:
+                push(Frame::GROUP, {}, 0);
+                expect(TokenType::LBRACKET);
+                step = Step::GROUP;
+                break;
+            default:
+                n = g_no_node;
+                break;
+            }
+            break;
+        case Step::PRIMARY:
+            step = Step::RESULT;
+
+            if (m_curr.type == TokenType::INFIX_FN)
+            {
+                push(Frame::INFIX, m_curr.value, 1);
+                m_stack.emplace_back(n);
+                expect(TokenType::INFIX_FN);
+                step = Step::EXPR;
+            }
+            break;
+        case Step::RESULT:
+        {
+            Frame &f = m_frames.back();
+
+            if (f.type == Frame::TOP && n == g_no_node)
+            {
+                end_row();
+                m_frames.pop_back();
+                break;
+            }
+
+            m_stack.emplace_back(n);
+            step = f.type == Frame::GROUP ? Step::GROUP : Step::EXPR;
+
+            if (f.type == Frame::TOP || f.type == Frame::GROUP || --f.remaining)
+                break;
+
+            // Arguments are added before their function, so every child has
+            // a smaller id than its parent
+            bool infix = f.type == Frame::INFIX;
+            n = m_ast.add(NodeType::FN, f.name);
+            pop_children(n, f.base);
+            m_frames.pop_back();
+
+            // a^b^c is a^{b^c}, and \frac{a}{b}^c raises the whole fraction
+            step = infix ? Step::RESULT : Step::PRIMARY;
+        } break;
+        case Step::GROUP:
+        {
+            const Frame &f = m_frames.back();
+
+            while (m_curr.type == TokenType::NEWLINE)
+                expect(TokenType::NEWLINE);
+
+            if (m_curr.type == TokenType::EOF_)
+            {
+                throw std::runtime_error(
+                    "Missing '}' for the '{' on line " + std::to_string(f.line) +
+                    ", column " + std::to_string(f.col));
+            }
+
+            if (m_curr.type != TokenType::RBRACKET)
+            {
+                step = Step::EXPR;
+                break;
+            }
+
+            expect(TokenType::RBRACKET);
+
+            if (m_stack.size() == f.base)
+                m_stack.emplace_back(m_ast.add(NodeType::NOOP));
+
+            n = m_ast.add(NodeType::COMPOUND);
+            pop_children(n, f.base);
+            m_frames.pop_back();
+            step = Step::PRIMARY;
+        } break;
         }
     }
+
+    // Only a '}' without a '{' stops the formula early
+    if (m_curr.type != TokenType::EOF_)
+    {
+        throw std::runtime_error(
+            "Unexpected '" + std::string(m_curr.value) + "' on line " +
+            std::to_string(m_curr.line) + ", column " + std::to_string(m_curr.col));
+    }
+
+    // A single row is the whole formula, as if there were no rows at all
+    if (m_stack.empty())
+    {
+        NodeId noop = m_ast.add(NodeType::NOOP);
+        NodeId comp = m_ast.add(NodeType::COMPOUND);
+        m_ast.set_children(comp, &noop, 1);
+        m_ast.set_root(comp);
+    }
+    else if (m_stack.size() == 1)
+    {
+        m_ast.set_root(m_stack[0]);
+    }
     else
     {
-        comp->comp_values[0] = std::make_unique<Node>(NodeType::NOOP);
+        NodeId lines = m_ast.add(NodeType::LINES);
+        pop_children(lines, 0);
+        m_ast.set_root(lines);
     }
 
-    return comp;
+    return std::move(m_ast);
 }
 
 void Parser::expect(TokenType type)
@@ -50,7 +192,8 @@ void Parser::expect(TokenType type)
     if (m_curr.type != type)
     {
         throw std::runtime_error(
-            "Unexpected token '" + m_curr.value + "' on line " + std::to_string(m_line) +
+            "Unexpected token '" + std::string(m_curr.value) + "' on line " +
+            std::to_string(m_curr.line) + ", column " + std::to_string(m_curr.col) +
             ", expected type " + std::to_string((int)type));
     }
     else
@@ -59,82 +202,34 @@ void Parser::expect(TokenType type)
     }
 }
 
-std::unique_ptr<Node> Parser::parse_expr()
+void Parser::push(Frame::Type type, std::string_view name, size_t remaining)
 {
-    if (m_curr.type == TokenType::NEWLINE)
-    {
-        expect(TokenType::NEWLINE);
-        ++m_line;
-    }
-
-    std::unique_ptr<Node> n;
-
-    switch (m_curr.type)
-    {
-    case TokenType::FN:
-        n = parse_fn();
-        break;
-    case TokenType::ID:
-        n = parse_id();
-        break;
-    case TokenType::LBRACKET:
-        n = parse_brackets();
-        break;
-    default:
-        n = nullptr;
-        break;
-    }
-
-    if (m_curr.type == TokenType::INFIX_FN)
+    // The formula itself is one frame
+    if (m_frames.size() > m_max_depth)
     {
-        std::unique_ptr<Node> fn = std::make_unique<Node>(NodeType::FN);
-        fn->fn_name = m_curr.value;
-        fn->fn_args.emplace_back(std::move(n));
-        expect(TokenType::INFIX_FN);
-        fn->fn_args.emplace_back(parse_expr());
-        return fn;
+        throw std::runtime_error(
+            "Formula is nested more than " + std::to_string(m_max_depth) +
+            " levels deep on line " + std::to_string(m_curr.line) + ", column " +
+            std::to_string(m_curr.col) + ", see --max-depth");
     }
 
-    return n;
+    m_frames.push_back({ type, name, m_stack.size(), remaining, m_curr.line, m_curr.col });
 }
 
-std::unique_ptr<Node> Parser::parse_id()
+void Parser::end_row()
 {
-    std::unique_ptr<Node> n = std::make_unique<Node>(NodeType::ID);
-    n->id = m_curr.value;
-    expect(TokenType::ID);
-    return n;
+    Frame &top = m_frames.front();
+    if (m_stack.size() == top.base)
+        return;
+
+    NodeId row = m_ast.add(NodeType::COMPOUND);
+    pop_children(row, top.base);
+    m_stack.emplace_back(row);
+    top.base = m_stack.size();
 }
 
-std::unique_ptr<Node> Parser::parse_brackets()
+void Parser::pop_children(NodeId id, size_t base)
 {
-    expect(TokenType::LBRACKET);
-    std::unique_ptr<Node> n = std::make_unique<Node>(NodeType::COMPOUND);
-
-    while (m_curr.type != TokenType::RBRACKET)
-        n->comp_values.emplace_back(parse_expr());
-
-    expect(TokenType::RBRACKET);
-
-    if (n->comp_values.empty())
-        n->comp_values.emplace_back(std::make_unique<Node>(NodeType::NOOP));
-
-    return n;
-}
-
-std::unique_ptr<Node> Parser::parse_fn()
-{
-    std::unique_ptr<Node> fn = std::make_unique<Node>(NodeType::FN);
-    fn->fn_name = m_curr.value;
-    expect(TokenType::FN);
-
-    size_t nparams = 0;
-    if (g_fn_param_nums.find(fn->fn_name) != g_fn_param_nums.end())
-        nparams = g_fn_param_nums[fn->fn_name];
-
-    while (fn->fn_args.size() < nparams)
-        fn->fn_args.emplace_back(parse_expr());
-
-    return fn;
+    m_ast.set_children(id, m_stack.data() + base, m_stack.size() - base);
+    m_stack.resize(base);
 }
-
@@ -2,25 +2,62 @@
 #include "node.h"
 #include "lexer.h"
 
+// Deepest nesting of groups, function arguments and ^/_ chains a formula
+// may have before it fails to parse. Set once at startup.
+extern size_t g_max_depth;
+
+// Parses with an explicit stack instead of recursion, so any depth up to
+// max_depth takes time and memory linear in the size of the formula
 class Parser
 {
 public:
-    Parser(const std::string &prog);
+    // prog is borrowed, see Lexer
+    Parser(std::string_view prog, size_t max_depth = g_max_depth);
     ~Parser();
 
-    std::unique_ptr<Node> parse();
+    Ast parse();
 
 private:
+    // Something that is waiting for expressions to be parsed
+    struct Frame
+    {
+        enum Type
+        {
+            // The formula itself, base is where the current row starts
+            TOP,
+            // { ... }
+            GROUP,
+            // A function waiting for its arguments
+            FN,
+            // ^ or _ waiting for its right side, the left one is on m_stack
+            INFIX
+        } type;
+
+        // Function name, for FN and INFIX
+        std::string_view name;
+        // Where the frame's children start on m_stack
+        size_t base;
+        // Children still missing, for FN and INFIX
+        size_t remaining;
+        // Where the frame started, for errors
+        size_t line, col;
+    };
+
     void expect(TokenType type);
+    void push(Frame::Type type, std::string_view name, size_t remaining);
+    // Groups what was parsed since the last newline into a row
+    void end_row();
 
-    std::unique_ptr<Node> parse_expr();
-    std::unique_ptr<Node> parse_id();
-    std::unique_ptr<Node> parse_brackets();
-    std::unique_ptr<Node> parse_fn();
+    // Moves everything above base on m_stack into the children of id
+    void pop_children(NodeId id, size_t base);
 
 private:
     Lexer m_lexer;
     Token m_curr;
-    size_t m_line{ 1 };
-};
+    size_t m_max_depth;
 
+    Ast m_ast;
+    // Children parsed so far for every node that is still being parsed
+    std::vector<NodeId> m_stack;
+    std::vector<Frame> m_frames;
+};
@@ -0,0 +1,227 @@
+#include "path.h"
+#include <cmath>
+#include <algorithm>
+
+// Longest line a curve is flattened into, in path units
+static const float g_flatness = 1.5f;
+
+void path::Path::move(float x, float y)
+{
+    m_open = m_points.size();
+    m_points.push_back({ x, y });
+}
+
+void path::Path::line(float x, float y)
+{
+    m_points.push_back({ x, y });
+}
+
+void path::Path::quad(float cx, float cy, float x, float y)
+{
+    Point p0 = m_points.back();
+    float len = std::hypot(cx - p0.x, cy - p0.y) + std::hypot(x - cx, y - cy);
+    int n = std::max(1, (int)std::ceil(len / g_flatness));
+
+    for (int i = 1; i <= n; ++i)
+    {
+        float t = (float)i / n, u = 1 - t;
+        line(u * u * p0.x + 2 * u * t * cx + t * t * x,
+            u * u * p0.y + 2 * u * t * cy + t * t * y);
+    }
+}
+
+void path::Path::close(bool hole)
+{
+    if (m_open == SIZE_MAX)
+        return;
+
+    // Shoelace, positive for outlines that turn clockwise on screen
+    float area = 0;
+    for (size_t i = m_open; i < m_points.size(); ++i)
+    {
+        const Point &a = m_points[i];
+        const Point &b = m_points[i + 1 < m_points.size() ? i + 1 : m_open];
+        area += a.x * b.y - b.x * a.y;
+    }
+
+    if ((area < 0) != hole)
+        std::reverse(m_points.begin() + m_open, m_points.end());
+
+    m_outlines.push_back(m_open);
+    m_open = SIZE_MAX;
+}
+
+void path::Path::stroke(float x1, float y1, float x2, float y2, float w)
+{
+    float len = std::hypot(x2 - x1, y2 - y1);
+    if (len == 0)
+        return;
+
+    // Along and across the stroke, half of w long
+    float ax = (x2 - x1) / len * w / 2, ay = (y2 - y1) / len * w / 2;
+    float nx = -ay, ny = ax;
+
+    move(x1 - ax + nx, y1 - ay + ny);
+    line(x2 + ax + nx, y2 + ay + ny);
+    line(x2 + ax - nx, y2 + ay - ny);
+    line(x1 - ax - nx, y1 - ay - ny);
+    close();
+}
+
+void path::Path::ellipse(float cx, float cy, float rx, float ry, bool hole)
+{
+    int n = std::max(8, (int)std::ceil(2 * (float)M_PI * std::max(rx, ry) / g_flatness));
+
+    move(cx + rx, cy);
+    for (int i = 1; i < n; ++i)
+    {
+        float a = 2 * (float)M_PI * i / n;
+        line(cx + rx * std::cos(a), cy + ry * std::sin(a));
+    }
+
+    close(hole);
+}
+
+path::Path path::Path::transformed(float x, float y, float sx, float sy) const
+{
+    Path p = *this;
+    for (Point &pt : p.m_points)
+    {
+        pt.x = x + pt.x * sx;
+        pt.y = y + pt.y * sy;
+    }
+
+    // Mirroring turns every outline around
+    if ((sx < 0) != (sy < 0))
+    {
+        for (size_t i = 0; i < p.m_outlines.size(); ++i)
+        {
+            size_t end = i + 1 < p.m_outlines.size() ? p.m_outlines[i + 1] : p.m_points.size();
+            std::reverse(p.m_points.begin() + p.m_outlines[i], p.m_points.begin() + end);
+        }
+    }
+
+    return p;
+}
+
+SDL_Rect path::Path::bounds() const
+{
+    if (m_points.empty())
+        return { 0, 0, 0, 0 };
+
+    float x0 = m_points[0].x, x1 = x0, y0 = m_points[0].y, y1 = y0;
+    for (const Point &p : m_points)
+    {
+        x0 = std::min(x0, p.x);
+        x1 = std::max(x1, p.x);
+        y0 = std::min(y0, p.y);
+        y1 = std::max(y1, p.y);
+    }
+
+    int l = std::floor(x0), t = std::floor(y0);
+    return { l, t, (int)std::ceil(x1) - l, (int)std::ceil(y1) - t };
+}
+
+namespace
+{
+    // Adds the signed area the edge from a to b covers in every pixel to
+    // its right to acc, which has w + 2 floats per row. Coordinates are
+    // relative to the area. Parts outside of it count as if they were on
+    // its edge, which is what they cover inside of it.
+    void edge(path::Point a, path::Point b, int w, int h, std::vector<float> &acc)
+    {
+        if (a.y == b.y)
+            return;
+
+        float dir = 1;
+        if (a.y > b.y)
+        {
+            std::swap(a, b);
+            dir = -1;
+        }
+
+        float dxdy = (b.x - a.x) / (b.y - a.y);
+        int first = std::max(0, (int)std::floor(a.y)),
+            last = std::min(h, (int)std::ceil(b.y));
+
+        for (int y = first; y < last; ++y)
+        {
+            float top = std::max((float)y, a.y), bottom = std::min(y + 1.f, b.y);
+            float d = (bottom - top) * dir;
+            float xa = std::clamp(a.x + (top - a.y) * dxdy, 0.f, (float)w),
+                xb = std::clamp(a.x + (bottom - a.y) * dxdy, 0.f, (float)w);
+
+            float x0 = std::min(xa, xb), x1 = std::max(xa, xb);
+            float *row = &acc[(size_t)y * (w + 2)];
+            int x0i = (int)x0, x1i = (int)std::ceil(x1);
+
+            if (x1i <= x0i + 1)
+            {
+                // Within one pixel, split at the middle of the edge
+                float mid = (x0 + x1) / 2 - x0i;
+                row[x0i] += d * (1 - mid);
+                row[x0i + 1] += d * mid;
+                continue;
+            }
+
+            // Across several pixels, the area grows linearly in between
+            float s = 1 / (x1 - x0);
+            float f0 = x0 - x0i, f1 = x1 - x1i + 1;
+            float a0 = .5f * s * (1 - f0) * (1 - f0),
+                am = .5f * s * f1 * f1;
+
+            row[x0i] += d * a0;
+            if (x1i == x0i + 2)
+                row[x0i + 1] += d * (1 - a0 - am);
+            else
+            {
+                float a1 = s * (1.5f - f0);
+                row[x0i + 1] += d * (a1 - a0);
+                for (int x = x0i + 2; x < x1i - 1; ++x)
+                    row[x] += d * s;
+
+                float a2 = a1 + (x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1 - a2 - am);
+            }
+            row[x1i] += d * am;
+        }
+    }
+}
+
+void path::rasterize(const Path &p, const SDL_Rect &area, std::vector<Uint8> &coverage)
+{
+    int w = std::max(area.w, 0), h = std::max(area.h, 0);
+    coverage.assign((size_t)w * h, 0);
+    if (!w || !h)
+        return;
+
+    std::vector<float> acc((size_t)(w + 2) * h, 0.f);
+    const std::vector<Point> &pts = p.points();
+    const std::vector<size_t> &outlines = p.outlines();
+
+    for (size_t i = 0; i < outlines.size(); ++i)
+    {
+        size_t begin = outlines[i],
+            end = i + 1 < outlines.size() ? outlines[i + 1] : pts.size();
+
+        for (size_t j = begin; j < end; ++j)
+        {
+            const Point &a = pts[j], &b = pts[j + 1 < end ? j + 1 : begin];
+            edge({ a.x - area.x, a.y - area.y }, { b.x - area.x, b.y - area.y }, w, h, acc);
+        }
+    }
+
+    // Every row sums to zero, so each can be summed up on its own
+    for (int y = 0; y < h; ++y)
+    {
+        const float *row = &acc[(size_t)y * (w + 2)];
+        Uint8 *out = &coverage[(size_t)y * w];
+
+        float sum = 0;
+        for (int x = 0; x < w; ++x)
+        {
+            sum += row[x];
+            out[x] = (Uint8)(std::min(std::abs(sum), 1.f) * 255 + .5f);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <SDL2/SDL.h>
+
+namespace path
+{
+    struct Point
+    {
+        float x, y;
+    };
+
+    // Outlines filled with the nonzero rule, every one that is started has
+    // to be closed. They're all turned the same way when they're closed, so
+    // overlapping ones merge and holes cut through whatever is under them.
+    // Curves are flattened into short lines as they're added.
+    class Path
+    {
+    public:
+        void move(float x, float y);
+        void line(float x, float y);
+        // Quadratic Bézier from the current point, bending towards (cx, cy)
+        void quad(float cx, float cy, float x, float y);
+        void close(bool hole = false);
+
+        // Straight stroke of width w with square ends half of w long
+        void stroke(float x1, float y1, float x2, float y2, float w);
+        void ellipse(float cx, float cy, float rx, float ry, bool hole = false);
+
+        // The same path scaled by (sx, sy), then moved by (x, y)
+        Path transformed(float x, float y, float sx, float sy) const;
+        // Smallest rect of whole pixels holding every point
+        SDL_Rect bounds() const;
+
+        bool empty() const { return m_points.empty(); }
+        const std::vector<Point> &points() const { return m_points; }
+        // Where every outline starts in points, each one ends where the
+        // next starts
+        const std::vector<size_t> &outlines() const { return m_outlines; }
+
+    private:
+        std::vector<Point> m_points;
+        std::vector<size_t> m_outlines;
+        // Start of the outline being added, SIZE_MAX if there is none
+        size_t m_open{ SIZE_MAX };
+    };
+
+    // Exact area of every pixel of area that p covers, 0 to 255, written to
+    // coverage row by row. Edges are accumulated as signed areas and summed
+    // along each row, so the whole path is rasterized in one pass.
+    void rasterize(const Path &p, const SDL_Rect &area, std::vector<Uint8> &coverage);
+}
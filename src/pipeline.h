@@ -0,0 +1,122 @@
+#pragma once
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace pipeline
+{
+    // Blocking queue with a fixed capacity so a fast stage can't run away
+    // from a slow one.
+    template <typename T>
+    class Queue
+    {
+    public:
+        Queue(size_t capacity)
+            : m_capacity(capacity) {}
+
+        // Blocks while full, returns false if the queue was closed
+        bool push(T v)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+            if (m_closed)
+                return false;
+
+            m_items.emplace_back(std::move(v));
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        // Blocks while empty, returns false once the queue is closed and drained
+        bool pop(T &v)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+            if (m_items.empty())
+                return false;
+
+            v = std::move(m_items.front());
+            m_items.pop_front();
+            m_not_full.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_not_empty.notify_all();
+            m_not_full.notify_all();
+        }
+
+    private:
+        std::deque<T> m_items;
+        size_t m_capacity;
+        bool m_closed{ false };
+
+        std::mutex m_mutex;
+        std::condition_variable m_not_empty, m_not_full;
+    };
+
+    // Calls f(i) for every i < n, spread over up to threads threads
+    // including the calling one
+    template <typename F>
+    void parallel_for(size_t n, size_t threads, F f)
+    {
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&] {
+            for (size_t i; (i = next++) < n;)
+                f(i);
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < std::min(threads, n); ++t)
+            pool.emplace_back(worker);
+
+        worker();
+        for (auto &t : pool)
+            t.join();
+    }
+
+    // Runs the same worker on n threads. on_done is called once by whichever
+    // thread finishes last, usually to close the next stage's queue.
+    class Stage
+    {
+    public:
+        Stage(size_t n, std::function<void()> worker, std::function<void()> on_done)
+            : m_running(n)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                m_threads.emplace_back([this, worker, on_done] {
+                    worker();
+                    if (--m_running == 0)
+                        on_done();
+                });
+            }
+        }
+
+        ~Stage()
+        {
+            join();
+        }
+
+        void join()
+        {
+            for (auto &t : m_threads)
+            {
+                if (t.joinable())
+                    t.join();
+            }
+        }
+
+    private:
+        std::vector<std::thread> m_threads;
+        std::atomic<size_t> m_running;
+    };
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include "trace.h"
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+namespace pool
+{
+    // Most bytes of render targets that are drawn on or kept for reuse at
+    // once, 0 for no limit. Set once at startup.
+    extern size_t g_budget;
+
+    // Rounds n up to a power of two or one and a half times one, so a
+    // recycled target is never more than 1.5 times as large as asked for
+    inline size_t size_class(size_t n)
+    {
+        size_t c = 64;
+        while (c < n)
+        {
+            if (c + c / 2 >= n)
+                return c + c / 2;
+            c *= 2;
+        }
+
+        return c;
+    }
+
+    // Render targets of one kind that were done with, grouped by size class
+    // so the next one that needs the same class can have it instead of a
+    // new one. Everything handed out goes towards g_budget until it's given
+    // back, kept targets are freed first whenever the budget would be
+    // exceeded. Safe to use from any thread.
+    template <typename T>
+    class Pool
+    {
+    public:
+        // release frees a target for good
+        explicit Pool(std::function<void(T&)> release)
+            : m_release(std::move(release)) {}
+
+        ~Pool()
+        {
+            clear();
+        }
+
+        Pool(const Pool&) = delete;
+        Pool &operator=(const Pool&) = delete;
+
+        // A kept target of size class key, or a new one from make. bytes is
+        // what a target of that class holds.
+        template <typename F>
+        T get(size_t key, size_t bytes, F make)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_live += bytes;
+
+                auto it = m_kept.find(key);
+                if (it != m_kept.end() && !it->second.empty())
+                {
+                    T target = std::move(it->second.back());
+                    it->second.pop_back();
+                    m_kept_bytes -= bytes;
+                    trace::count(trace::Counter::TARGETS_REUSED);
+                    trace::count(trace::Counter::POOLED_BYTES, -(int64_t)bytes);
+                    return target;
+                }
+
+                // Make room for it out of what is kept
+                evict();
+            }
+
+            return make();
+        }
+
+        // Takes back a target from get, it's kept unless the budget is full
+        void put(size_t key, size_t bytes, T target)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_live -= std::min(m_live, bytes);
+
+            if (g_budget && m_live + m_kept_bytes + bytes > g_budget)
+            {
+                trace::count(trace::Counter::TARGETS_EVICTED);
+                m_release(target);
+                return;
+            }
+
+            m_kept[key].push_back(std::move(target));
+            m_kept_bytes += bytes;
+            m_sizes[key] = bytes;
+            trace::count(trace::Counter::POOLED_BYTES, bytes);
+        }
+
+        // Stops counting a target from get that won't be given back
+        void forget(size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_live -= std::min(m_live, bytes);
+        }
+
+        // Frees every kept target
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &[key, targets] : m_kept)
+            {
+                for (T &t : targets)
+                    m_release(t);
+            }
+
+            trace::count(trace::Counter::POOLED_BYTES, -(int64_t)m_kept_bytes);
+            m_kept.clear();
+            m_kept_bytes = 0;
+        }
+
+    private:
+        // Frees kept targets until everything fits in the budget again
+        void evict()
+        {
+            if (!g_budget)
+                return;
+
+            for (auto &[key, targets] : m_kept)
+            {
+                while (!targets.empty() && m_live + m_kept_bytes > g_budget)
+                {
+                    trace::count(trace::Counter::TARGETS_EVICTED);
+                    trace::count(trace::Counter::POOLED_BYTES, -(int64_t)m_sizes[key]);
+                    m_kept_bytes -= m_sizes[key];
+                    m_release(targets.back());
+                    targets.pop_back();
+                }
+            }
+        }
+
+    private:
+        std::function<void(T&)> m_release;
+
+        std::mutex m_mutex;
+        std::unordered_map<size_t, std::vector<T>> m_kept;
+        // Bytes of a target of every size class
+        std::unordered_map<size_t, size_t> m_sizes;
+        size_t m_kept_bytes{ 0 };
+        // Handed out and not given back yet
+        size_t m_live{ 0 };
+    };
+}
@@ -0,0 +1,130 @@
+#include "resources.h"
+#include "hash.h"
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+
+#ifdef ACRYLIC_EMBED
+// Puts the contents of path into the binary between name and name_end.
+// Paths are relative to where the compiler runs, the repository root.
+#ifdef __APPLE__
+#define EMBED(name, path) \
+    __asm__(".const_data\n.globl _" #name "\n.balign 16\n_" #name ":\n" \
+        ".incbin \"" path "\"\n.globl _" #name "_end\n_" #name "_end:\n.byte 0\n.text\n"); \
+    extern "C" const char name[], name##_end[];
+#else
+#define EMBED(name, path) \
+    __asm__(".section .rodata\n.globl " #name "\n.balign 16\n" #name ":\n" \
+        ".incbin \"" path "\"\n.globl " #name "_end\n" #name "_end:\n.byte 0\n.previous\n"); \
+    extern "C" const char name[], name##_end[];
+#endif
+
+EMBED(acrylic_font_ttf, "res/font.ttf")
+#endif
+
+namespace
+{
+    // Guards g_files
+    std::mutex g_mutex;
+
+#ifdef ACRYLIC_EMBED
+    const std::unordered_map<std::string, std::string_view> g_files = {
+        { "font.ttf", { acrylic_font_ttf, (size_t)(acrylic_font_ttf_end - acrylic_font_ttf) } }
+    };
+#else
+    // Read once and kept, open fonts point into them
+    std::unordered_map<std::string, std::string> g_files;
+    // Files replaced by reload_font, kept while fonts opened from them may
+    // still be open
+    std::vector<std::string> g_old;
+
+    std::string read(const std::string &name)
+    {
+        std::ifstream ifs("res/" + name, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(ifs), {});
+    }
+#endif
+}
+
+std::string_view resources::file(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+#ifdef ACRYLIC_EMBED
+    auto it = g_files.find(name);
+    return it == g_files.end() ? std::string_view() : it->second;
+#else
+    auto it = g_files.find(name);
+    if (it == g_files.end())
+        it = g_files.emplace(name, read(name)).first;
+
+    return it->second;
+#endif
+}
+
+TTF_Font *resources::font(int size)
+{
+    std::string_view data = file("font.ttf");
+    if (data.empty())
+        return nullptr;
+
+    return TTF_OpenFontRW(SDL_RWFromConstMem(data.data(), data.size()), 1, size);
+}
+
+TTF_Font *resources::reload_font(int size)
+{
+#ifdef ACRYLIC_EMBED
+    return font(size);
+#else
+    std::string data = read("font.ttf");
+    if (data.empty())
+    {
+        TTF_SetError("res/font.ttf is missing");
+        return nullptr;
+    }
+
+    TTF_Font *f = TTF_OpenFontRW(SDL_RWFromConstMem(data.data(), data.size()), 1, size);
+    if (!f)
+        return nullptr;
+
+    // Fonts point into the strings, which are far too long to be stored
+    // inline, so moving them leaves the bytes where they are
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::string &cur = g_files["font.ttf"];
+    g_old.emplace_back(std::move(cur));
+    cur = std::move(data);
+    return f;
+#endif
+}
+
+void resources::release_old()
+{
+#ifndef ACRYLIC_EMBED
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_old.clear();
+#endif
+}
+
+Uint64 resources::fingerprint()
+{
+    // Hashing all of a large font would cost more than the rest of a
+    // start, its size and the start and end of it are enough to tell
+    // fonts apart
+    std::string_view data = file("font.ttf");
+    size_t n = std::min<size_t>(data.size(), 4096);
+
+    Uint64 h = hash::combine(hash::g_offset, data.size());
+    h = hash::bytes(data.data(), n, h);
+    return hash::bytes(data.data() + data.size() - n, n, h);
+}
+
+void resources::free()
+{
+#ifndef ACRYLIC_EMBED
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_files.clear();
+    g_old.clear();
+#endif
+}
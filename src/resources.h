@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+namespace resources
+{
+    // Contents of a file in res/. Builds with ACRYLIC_EMBED have them
+    // compiled in, others read res/ from the working directory the first
+    // time a file is asked for. Empty if the file is missing.
+    std::string_view file(const std::string &name);
+
+    // The font at size pixels, nullptr if it can't be opened
+    TTF_Font *font(int size);
+    // Reads the font from res/ again and opens it at size pixels. Returns
+    // nullptr if it's missing or broken, and then the font in use stays as
+    // it is. Builds with ACRYLIC_EMBED have nothing to read again. The data
+    // of the font it replaces is kept until release_old, to be called once
+    // every font opened from it is closed.
+    TTF_Font *reload_font(int size);
+    void release_old();
+    // Changes when the font does, for cache keys
+    Uint64 fingerprint();
+
+    // Builds without ACRYLIC_EMBED read res/ again after this, so every
+    // font opened by font has to be closed first. Does nothing otherwise.
+    void free();
+}
@@ -0,0 +1,332 @@
+#include "server.h"
+#include "parser.h"
+#include "draw.h"
+#include "encode.h"
+#include <set>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <filesystem>
+#include <shared_mutex>
+#include <condition_variable>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+namespace
+{
+    volatile sig_atomic_t g_stop = 0,
+        g_reload = 0;
+
+    void on_signal(int sig)
+    {
+        if (sig == SIGHUP)
+            g_reload = 1;
+        else
+            g_stop = 1;
+    }
+
+    // Renders hold it shared, a reload takes it exclusively
+    std::shared_mutex g_render_mutex;
+
+    cache::Cache *g_cache{ nullptr };
+    // Canonical, empty if output paths aren't allowed
+    std::filesystem::path g_out_dir;
+
+    // Longest formula or path a client may send
+    const Uint32 g_max_len = 16 << 20;
+
+    bool read_all(int fd, void *buf, size_t n)
+    {
+        Uint8 *p = (Uint8*)buf;
+        while (n)
+        {
+            ssize_t r = recv(fd, p, n, 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+
+            p += r;
+            n -= r;
+        }
+
+        return true;
+    }
+
+    bool write_all(int fd, const void *buf, size_t n)
+    {
+        const Uint8 *p = (const Uint8*)buf;
+        while (n)
+        {
+            ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+
+            p += r;
+            n -= r;
+        }
+
+        return true;
+    }
+
+    bool read_u32(int fd, Uint32 &v)
+    {
+        Uint8 b[4];
+        if (!read_all(fd, b, 4))
+            return false;
+
+        v = b[0] | b[1] << 8 | b[2] << 16 | (Uint32)b[3] << 24;
+        return true;
+    }
+
+    void put_u32(Uint8 *out, Uint32 v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out[i] = v >> (8 * i) & 255;
+    }
+
+    bool respond(int fd, Uint32 status, const std::vector<Uint8> &payload)
+    {
+        Uint8 head[8];
+        put_u32(head, status);
+        put_u32(head + 4, payload.size());
+        return write_all(fd, head, 8) && write_all(fd, payload.data(), payload.size());
+    }
+
+    // Where a client's output path goes inside g_out_dir. Throws if paths
+    // aren't allowed or the path leads outside of it, through .. or a
+    // symlink.
+    std::string resolve(const std::string &path)
+    {
+        namespace fs = std::filesystem;
+        if (g_out_dir.empty())
+            throw std::runtime_error("Output paths aren't allowed, start the server with --out");
+
+        fs::path p(path);
+        std::error_code ec;
+        fs::path full = fs::weakly_canonical(g_out_dir / p, ec);
+        fs::path rel = full.lexically_relative(g_out_dir);
+        if (ec || p.is_absolute() || rel.empty() || *rel.begin() == ".." || rel == ".")
+            throw std::runtime_error("Output path '" + path + "' is outside of the output directory");
+
+        return full.string();
+    }
+
+    // Fills payload with the image, the path it was written to or an error
+    Uint32 render(draw::Backend &be, const std::string &formula, const std::string &path,
+        std::vector<Uint8> &payload)
+    {
+        try
+        {
+            std::string src = formula + '\n';
+            Parser p(src);
+            Ast ast = p.parse();
+            std::string out = path.empty() ? path : resolve(path);
+
+            cache::Key key;
+            if (g_cache)
+            {
+                key = g_cache->key(ast);
+                if (path.empty() ? g_cache->fetch(key, payload) : g_cache->fetch(key, out))
+                {
+                    if (!path.empty())
+                        payload.assign(path.begin(), path.end());
+                    return 0;
+                }
+            }
+
+            Image img;
+            {
+                std::shared_lock<std::shared_mutex> lock(g_render_mutex);
+                img = draw::render(be, ast);
+            }
+
+            if (path.empty())
+            {
+                if (!encode::save(img, payload))
+                    throw std::runtime_error("Couldn't encode image");
+
+                if (g_cache)
+                    g_cache->store(key, payload);
+            }
+            else
+            {
+                if (!encode::save(img, out))
+                    throw std::runtime_error("Couldn't write '" + path + "'");
+
+                if (g_cache)
+                    g_cache->store(key, out);
+                payload.assign(path.begin(), path.end());
+            }
+
+            return 0;
+        }
+        catch (const std::exception &e)
+        {
+            std::string msg = e.what();
+            payload.assign(msg.begin(), msg.end());
+            return 1;
+        }
+    }
+
+    void serve(int fd)
+    {
+        std::unique_ptr<draw::Backend> be = draw::make_cpu_backend();
+
+        while (true)
+        {
+            Uint32 flen, plen;
+            if (!read_u32(fd, flen) || !read_u32(fd, plen))
+                break;
+
+            if (flen > g_max_len || plen > g_max_len)
+            {
+                std::string msg = "Request too large";
+                respond(fd, 1, std::vector<Uint8>(msg.begin(), msg.end()));
+                break;
+            }
+
+            std::string formula(flen, '\0'),
+                path(plen, '\0');
+            if (!read_all(fd, &formula[0], flen) || !read_all(fd, &path[0], plen))
+                break;
+
+            std::vector<Uint8> payload;
+            Uint32 status = render(*be, formula, path, payload);
+            if (!respond(fd, status, payload))
+                break;
+        }
+    }
+}
+
+int server::run(const Options &opts, cache::Cache *cache)
+{
+    g_cache = cache;
+    const std::string &socket_path = opts.socket_path;
+
+    if (!opts.out_dir.empty())
+    {
+        std::error_code ec;
+        g_out_dir = std::filesystem::canonical(opts.out_dir, ec);
+        if (ec)
+        {
+            std::cerr << "Output directory '" << opts.out_dir << "': " << ec.message() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Socket path '" << socket_path << "' is too long.\n";
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+
+    // Created without access for anyone else, so other local users can't
+    // connect and render or write files as this one
+    mode_t mask = umask(0177);
+    bool bound = lfd >= 0 && bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(mask);
+
+    if (!bound || listen(lfd, 64) < 0)
+    {
+        std::cerr << "Couldn't listen on '" << socket_path << "': " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa{};
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "Listening on '" << socket_path << "'.\n";
+
+    std::mutex clients_mutex;
+    std::condition_variable clients_done;
+    std::set<int> clients;
+
+    while (!g_stop)
+    {
+        if (g_reload)
+        {
+            g_reload = 0;
+            std::unique_lock<std::shared_mutex> lock(g_render_mutex);
+            if (draw::reload())
+            {
+                std::cerr << "Reloaded font.\n";
+                if (g_cache)
+                    g_cache->refresh();
+            }
+            if (g_cache)
+                g_cache->evict();
+        }
+
+        // At the limit, clients wait in the listen queue until one hangs up
+        {
+            std::unique_lock<std::mutex> lock(clients_mutex);
+            if (opts.max_clients && clients.size() >= opts.max_clients)
+            {
+                clients_done.wait_for(lock, std::chrono::milliseconds(200));
+                continue;
+            }
+        }
+
+        // Wake up regularly to notice signals
+        pollfd pfd = { lfd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        int fd = accept(lfd, 0, 0);
+        if (fd < 0)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            clients.insert(fd);
+        }
+
+        std::thread([fd, &clients, &clients_mutex, &clients_done] {
+            serve(fd);
+
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                clients.erase(fd);
+                clients_done.notify_all();
+            }
+
+            close(fd);
+        }).detach();
+    }
+
+    close(lfd);
+    unlink(socket_path.c_str());
+
+    // Answer whatever is in flight, but don't wait for idle clients to hang up
+    std::unique_lock<std::mutex> lock(clients_mutex);
+    for (int fd : clients)
+        shutdown(fd, SHUT_RD);
+    clients_done.wait(lock, [&] { return clients.empty(); });
+
+    if (g_cache)
+        std::cerr << "Cache: " << g_cache->hits() << " hits, " << g_cache->misses() << " misses.\n";
+    std::cerr << "Stopped.\n";
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "cache.h"
+#include <string>
+
+// Long running render daemon on a unix domain socket. Every request is
+// answered on the same connection, a client can send as many as it wants.
+//
+// All integers are 32 bit little endian.
+//
+//   request:  formula length | output path length | formula | output path
+//   response: status | payload length | payload
+//
+// With an empty output path the payload is the encoded image itself, in
+// --format, otherwise the image is written to the path and the payload is
+// the path. Output paths are relative to Options::out_dir and can't leave
+// it. A non zero status means the payload is an error message.
+//
+// The socket is only accessible to the user running the server.
+//
+// SIGHUP reloads the font, SIGINT and SIGTERM stop accepting clients and
+// exit once the requests in flight are answered.
+namespace server
+{
+    struct Options
+    {
+        std::string socket_path;
+        // Where output paths are written, requests with one are refused if
+        // this is empty
+        std::string out_dir;
+        // Clients served at once, each gets a thread. More wait to be
+        // accepted until one hangs up.
+        size_t max_clients{ 64 };
+    };
+
+    // Rendered images are looked up in and added to cache if there is one
+    int run(const Options &opts, cache::Cache *cache = nullptr);
+}
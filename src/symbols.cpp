@@ -0,0 +1,137 @@
+#include "symbols.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    // Fills the stroke along a line through pts whose width goes from thin
+    // at both ends to thick in the middle
+    void swell(path::Path &p, const std::vector<path::Point> &pts, float thin, float thick)
+    {
+        size_t n = pts.size();
+        std::vector<path::Point> left(n), right(n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const path::Point &a = pts[i ? i - 1 : i], &b = pts[i + 1 < n ? i + 1 : i];
+            float dx = b.x - a.x, dy = b.y - a.y;
+            float len = std::max(std::hypot(dx, dy), 1e-6f);
+
+            float t = (float)i / (n - 1);
+            float w = (thin + (thick - thin) * std::sin((float)M_PI * t)) / 2;
+            left[i] = { pts[i].x - dy / len * w, pts[i].y + dx / len * w };
+            right[i] = { pts[i].x + dy / len * w, pts[i].y - dx / len * w };
+        }
+
+        p.move(left[0].x, left[0].y);
+        for (size_t i = 1; i < n; ++i)
+            p.line(left[i].x, left[i].y);
+        for (size_t i = n; i-- > 0;)
+            p.line(right[i].x, right[i].y);
+        p.close();
+    }
+
+    // Points along a quadratic Bézier, without the first one
+    void curve(std::vector<path::Point> &pts, float cx, float cy, float x, float y, int n)
+    {
+        path::Point p0 = pts.back();
+        for (int i = 1; i <= n; ++i)
+        {
+            float t = (float)i / n, u = 1 - t;
+            pts.push_back({ u * u * p0.x + 2 * u * t * cx + t * t * x,
+                u * u * p0.y + 2 * u * t * cy + t * t * y });
+        }
+    }
+}
+
+path::Path symbols::radical(float w, float h, float gap)
+{
+    path::Path p;
+    p.stroke(0, h - 17, 3, h - 19, g_stroke * .7f);
+    p.stroke(3, h - 19, gap - 3, h - 1, g_stroke * 1.4f);
+    p.stroke(gap - 3, h - 1, gap - 1, 1, g_stroke * .7f);
+    p.stroke(gap - 1, 1, w, 1, g_stroke);
+    return p;
+}
+
+path::Path symbols::arrow(float w, float h)
+{
+    float y = h / 2;
+
+    path::Path p;
+    p.stroke(0, y, w - 1, y, g_stroke * .9f);
+    p.stroke(w - 5, y - 4, w - .5f, y, g_stroke * .9f);
+    p.stroke(w - 5, y + 4, w - .5f, y, g_stroke * .9f);
+    return p;
+}
+
+path::Path symbols::integral(float w, float h)
+{
+    // A slanted stem with a hook at both ends, ending in drops
+    std::vector<path::Point> pts = { { w * .92f, h * .07f } };
+    curve(pts, w * .8f, h * -.01f, w * .62f, h * .06f, 8);
+    curve(pts, w * .5f, h * .5f, w * .38f, h * .94f, 32);
+    curve(pts, w * .2f, h * 1.01f, w * .08f, h * .93f, 8);
+
+    path::Path p;
+    swell(p, pts, w * .08f, w * .3f);
+    p.ellipse(w * .88f, h * .07f, w * .1f, w * .1f);
+    p.ellipse(w * .12f, h * .93f, w * .1f, w * .1f);
+    return p;
+}
+
+path::Path symbols::ointegral(float w, float h)
+{
+    path::Path p = integral(w, h);
+    float r = w * .48f;
+    p.ellipse(w / 2, h / 2, r, r);
+    p.ellipse(w / 2, h / 2, r - g_stroke * .8f, r - g_stroke * .8f, true);
+    return p;
+}
+
+path::Path symbols::sigma(float w, float h)
+{
+    float l = w * .12f, r = w * .88f,
+        top = h * .1f, bottom = h * .9f;
+
+    path::Path p;
+    p.stroke(l, top, r, top, h * .05f);
+    p.stroke(l, bottom, r, bottom, h * .05f);
+    p.stroke(l + w * .02f, top, w * .52f, h / 2, h * .09f);
+    p.stroke(w * .52f, h / 2, l, bottom, h * .04f);
+
+    // Serifs at the open ends of the bars
+    p.stroke(r, top, r + w * .02f, top + h * .1f, h * .03f);
+    p.stroke(r, bottom, r + w * .02f, bottom - h * .1f, h * .03f);
+    return p;
+}
+
+path::Path symbols::paren(float w, float h, bool right)
+{
+    // Outer and inner edge of the curve, apart by thick in the middle and
+    // by thin at the ends
+    float thin = w * .15f, thick = std::min(w * .3f, g_stroke + h / 40);
+    float mid = w * .15f;
+
+    path::Path p;
+    p.move(w - thin, 0);
+    p.quad(2 * mid - (w - thin), h / 2, w - thin, h);
+    p.line(w, h);
+    p.quad(2 * (mid + thick) - w, h / 2, w, 0);
+    p.close();
+
+    return right ? p.transformed(w, 0, -1, 1) : p;
+}
+
+path::Path symbols::bracket(float w, float h, bool right)
+{
+    float x = w * .3f;
+
+    path::Path p;
+    p.stroke(x, 1, x, h - 1, g_stroke * 1.2f);
+    p.stroke(x, 1, w * .9f, 1, g_stroke);
+    p.stroke(x, h - 1, w * .9f, h - 1, g_stroke);
+
+    return right ? p.transformed(w, 0, -1, 1) : p;
+}
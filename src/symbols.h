@@ -0,0 +1,22 @@
+#pragma once
+#include "path.h"
+
+// Outlines of the symbols that aren't taken from the font, made to fit a
+// box of w by h layout units. They're rasterized at the size they end up
+// at, so they stay sharp however far a formula is scaled.
+namespace symbols
+{
+    // Width of strokes at the layout size
+    const float g_stroke = 2.f;
+
+    path::Path radical(float w, float h, float gap);
+    path::Path arrow(float w, float h);
+    path::Path integral(float w, float h);
+    path::Path ointegral(float w, float h);
+    path::Path sigma(float w, float h);
+
+    // Delimiters stretched to the height of what's between them, the
+    // right one is the left one mirrored
+    path::Path paren(float w, float h, bool right);
+    path::Path bracket(float w, float h, bool right);
+}
@@ -1,5 +1,5 @@
 #pragma once
-#include <string>
+#include <string_view>
 
 enum class TokenType
 {
@@ -15,10 +15,13 @@ enum class TokenType
 struct Token
 {
     Token() = default;
-    Token(TokenType type, const std::string &value)
-        : type(type), value(value) {}
+    Token(TokenType type, std::string_view value, size_t line, size_t col)
+        : type(type), value(value), line(line), col(col) {}
 
     TokenType type{ TokenType::ID };
-    std::string value;
-};
+    // Points into the lexer's source, valid as long as the source is
+    std::string_view value;
 
+    // Where the token starts, both counted from 1
+    size_t line{ 1 }, col{ 1 };
+};
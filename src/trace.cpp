@@ -0,0 +1,169 @@
+#include "trace.h"
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+bool trace::g_enabled = false;
+
+namespace
+{
+    struct Event
+    {
+        std::string name;
+        // Microseconds since enable, dur is -1 for counter samples
+        int64_t ts, dur;
+        int64_t value;
+        int tid;
+    };
+
+    struct Stage
+    {
+        size_t count{ 0 };
+        int64_t total{ 0 }, max{ 0 };
+    };
+
+    const char *g_counter_names[] = {
+        "textures_created",
+        "render_target_switches",
+        "glyphs_rasterized",
+        "bytes_written",
+        "texture_bytes",
+        "targets_reused",
+        "targets_evicted",
+        "pooled_bytes"
+    };
+
+    std::chrono::steady_clock::time_point g_start;
+
+    std::atomic<int64_t> g_counters[(int)trace::Counter::COUNT];
+    std::atomic<int64_t> g_peak_texture_bytes{ 0 };
+
+    std::mutex g_mutex;
+    std::vector<Event> g_events;
+    std::map<std::string, Stage> g_stages;
+
+    int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - g_start).count();
+    }
+
+    // Small stable thread numbers read better in a trace viewer than hashes
+    int thread_id()
+    {
+        static std::atomic<int> next{ 0 };
+        thread_local int id = next++;
+        return id;
+    }
+
+    void json_string(std::ostream &out, const std::string &s)
+    {
+        out << '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if ((unsigned char)c < 0x20)
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+                    << std::dec << std::setfill(' ');
+            else
+                out << c;
+        }
+        out << '"';
+    }
+}
+
+void trace::enable()
+{
+    g_start = std::chrono::steady_clock::now();
+    g_enabled = true;
+}
+
+void trace::Scope::begin(std::string_view prefix, std::string_view name)
+{
+    m_active = true;
+    m_name.reserve(prefix.size() + name.size());
+    m_name.append(prefix).append(name);
+    m_start = now();
+}
+
+void trace::Scope::end()
+{
+    int64_t dur = now() - m_start;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Stage &s = g_stages[m_name];
+    ++s.count;
+    s.total += dur;
+    s.max = std::max(s.max, dur);
+
+    g_events.push_back({ std::move(m_name), m_start, dur, 0, thread_id() });
+}
+
+void trace::add(Counter c, int64_t n)
+{
+    int64_t value = g_counters[(int)c] += n;
+    if (c != Counter::TEXTURE_BYTES)
+        return;
+
+    int64_t peak = g_peak_texture_bytes;
+    while (value > peak && !g_peak_texture_bytes.compare_exchange_weak(peak, value))
+        ;
+
+    // Memory shows up as a graph in the trace
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_events.push_back({ g_counter_names[(int)c], now(), -1, value, thread_id() });
+}
+
+void trace::write_stats(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    out << std::fixed << std::setprecision(3) << "{\n  \"stages\": {";
+    bool first = true;
+    for (const auto &[name, s] : g_stages)
+    {
+        out << (first ? "\n    " : ",\n    ");
+        json_string(out, name);
+        out << ": { \"count\": " << s.count << ", \"total_ms\": " << s.total / 1000.0
+            << ", \"max_ms\": " << s.max / 1000.0 << " }";
+        first = false;
+    }
+
+    out << "\n  },\n  \"counters\": {\n";
+    for (int i = 0; i < (int)Counter::COUNT; ++i)
+        out << "    \"" << g_counter_names[i] << "\": " << g_counters[i] << ",\n";
+    out << "    \"peak_texture_bytes\": " << g_peak_texture_bytes << "\n  }\n}\n";
+}
+
+bool trace::write_trace(const std::string &path)
+{
+    std::ofstream ofs(path);
+    if (!ofs)
+        return false;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < g_events.size(); ++i)
+    {
+        const Event &e = g_events[i];
+        ofs << (i ? ",\n" : "\n") << "{\"name\":";
+        json_string(ofs, e.name);
+
+        if (e.dur >= 0)
+            ofs << ",\"ph\":\"X\",\"ts\":" << e.ts << ",\"dur\":" << e.dur;
+        else
+            ofs << ",\"ph\":\"C\",\"ts\":" << e.ts << ",\"args\":{\"bytes\":" << e.value << "}";
+
+        ofs << ",\"pid\":1,\"tid\":" << e.tid << "}";
+    }
+    ofs << "\n]}\n";
+
+    return (bool)ofs;
+}
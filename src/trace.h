@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <cstdint>
+
+// Wall time of the stages of a render and counters of what they did, for
+// --stats and --trace. While disabled every call is a single branch.
+namespace trace
+{
+    enum class Counter
+    {
+        TEXTURES,
+        TARGET_SWITCHES,
+        GLYPHS,
+        BYTES_WRITTEN,
+        // Current size of every texture and cpu canvas, the peak is kept too
+        TEXTURE_BYTES,
+        // Render targets handed out again by a pool, and ones a pool freed
+        // to stay within its budget
+        TARGETS_REUSED,
+        TARGETS_EVICTED,
+        // Current size of the targets kept in pools, part of TEXTURE_BYTES
+        POOLED_BYTES,
+        COUNT
+    };
+
+    extern bool g_enabled;
+
+    // Starts recording, timestamps count from here. Call before any thread
+    // that records is started.
+    void enable();
+
+    // Records the time from construction to destruction as one event
+    class Scope
+    {
+    public:
+        Scope(const char *name)
+        {
+            if (g_enabled) begin(name, {});
+        }
+
+        // Named prefix + name, for stages that run per function
+        Scope(const char *prefix, std::string_view name)
+        {
+            if (g_enabled) begin(prefix, name);
+        }
+
+        ~Scope()
+        {
+            if (m_active) end();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope &operator=(const Scope&) = delete;
+
+    private:
+        void begin(std::string_view prefix, std::string_view name);
+        void end();
+
+    private:
+        bool m_active{ false };
+        std::string m_name;
+        int64_t m_start{ 0 };
+    };
+
+    void add(Counter c, int64_t n);
+
+    inline void count(Counter c, int64_t n = 1)
+    {
+        if (g_enabled) add(c, n);
+    }
+
+    // Totals per stage and the counters as JSON
+    void write_stats(std::ostream &out);
+    // Every recorded event in the Chrome trace event format, for
+    // chrome://tracing or Perfetto. Returns false if path can't be written.
+    bool write_trace(const std::string &path);
+}